@@ -0,0 +1,38 @@
+-- Coroutine throughput: create a coroutine, resume it until it
+-- finishes, and drop it, as a server does once per request. Dead
+-- threads are reused from the thread pool, so this should run without
+-- allocating new stacks once the pool is warm.
+-- Usage: sol coroutine.sol [coroutines]
+local N = tonumber(arg and arg[1]) or 1000000
+
+local function body (a)
+  local b = coroutine.yield(a + 1)
+  return a + b
+end
+
+local function bench (name, run)
+  collectgarbage()
+  local t = os.clock()
+  run()
+  t = os.clock() - t
+  print(string.format("%-22s %9d  %8.3f s  %9.0f coroutines/s", name, N,
+                      t, N / t))
+end
+
+bench("create/resume/finish", function ()
+  local create, resume = coroutine.create, coroutine.resume
+  for i = 1, N do
+    local co = create(body)
+    resume(co, i)
+    resume(co, i)
+  end
+end)
+
+bench("wrap/call/finish", function ()
+  local wrap = coroutine.wrap
+  for i = 1, N do
+    local f = wrap(body)
+    f(i)
+    f(i)
+  end
+end)
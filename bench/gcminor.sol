@@ -0,0 +1,35 @@
+-- Minor-collection cost against the size of an old table: each step
+-- stores one young value into a big old table (array part, then hash
+-- part) and runs a young collection. With card marking the time per
+-- collection should stay flat as the table grows.
+-- Usage: sol gcminor.sol [steps]
+local STEPS = tonumber(arg and arg[1]) or 2000
+
+local function bench (kind, size)
+  local big = {}
+  if kind == "array" then
+    for i = 1, size do big[i] = i end
+  else
+    for i = 1, size do big["k" .. i] = i end
+  end
+  collectgarbage("generational")
+  collectgarbage()
+  collectgarbage()  -- 'big' and its contents are old now
+  local t = os.clock()
+  for i = 1, STEPS do
+    local k = (kind == "array") and (i * 7919) % size + 1
+                                 or "k" .. ((i * 7919) % size + 1)
+    big[k] = {i}  -- a young value in an old table
+    collectgarbage("step", 0)
+  end
+  t = os.clock() - t
+  print(string.format("%-6s %9d  %9.2f us/step", kind, size,
+                      t / STEPS * 1e6))
+  collectgarbage("incremental")
+end
+
+for _, kind in ipairs{"array", "hash"} do
+  for _, size in ipairs{1000, 10000, 100000, 1000000} do
+    bench(kind, size)
+  end
+end
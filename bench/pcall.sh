@@ -0,0 +1,17 @@
+#!/bin/sh
+# Build Sol as C ('make linux', errors with setjmp/longjmp) and as C++
+# ('make linux-cxx', errors with exceptions) in temporary directories and
+# run the pcall microbenchmark on both builds.
+# Usage: pcall.sh [calls]
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/solbench.XXXXXX")
+trap 'rm -rf "$tmp"' EXIT
+for plat in linux linux-cxx; do
+  mkdir "$tmp/$plat"
+  cp "$here"/../src/*.[ch] "$here"/../src/*.hpp "$here"/../src/Makefile \
+     "$tmp/$plat"
+  make -s -C "$tmp/$plat" "$plat" >/dev/null
+  echo "== $plat"
+  "$tmp/$plat/sol" "$here/pcall.sol" "$@"
+done
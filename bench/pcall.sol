@@ -0,0 +1,20 @@
+-- pcall microbenchmark: cost of a protected call on the success path
+-- and when an error is raised. Run it on a C build (setjmp/longjmp) and
+-- on a C++ build (exceptions) to compare them; 'pcall.sh' does both.
+-- Usage: sol pcall.sol [calls]
+local N = tonumber(arg and arg[1]) or 20000000
+
+local function ok () end
+local function fail () error("x") end
+
+local function bench (name, f, n)
+  local pcall = pcall
+  local t = os.clock()
+  for i = 1, n do pcall(f) end
+  t = os.clock() - t
+  print(string.format("%-12s %9d calls  %7.3f s  %7.1f ns/call", name, n,
+                      t, t / n * 1e9))
+end
+
+bench("pcall", ok, N)
+bench("pcall+error", fail, N // 20)
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Build-time benchmark for 'solc -j': generate a synthetic source tree
+# and time compiling all of it sequentially and on N threads, checking
+# that both outputs are identical.
+# Usage: solcjobs.sh [solc [files [threads]]]
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+solc=${1:-$here/../src/solc}
+files=${2:-2000}
+jobs=${3:-$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)}
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/solbench.XXXXXX")
+trap 'rm -rf "$tmp"' EXIT
+
+# each module has a few hundred lines: functions, tables and strings
+i=0
+while [ $i -lt "$files" ]; do
+  d=$tmp/src/m$((i % 20))
+  mkdir -p "$d"
+  awk -v n=$i 'BEGIN {
+    print "local M = {}"
+    for (f = 1; f <= 40; f++) {
+      print "function M.f" f "(t, x)"
+      print "  local s = 0"
+      print "  for i = 1, #t do s = s + t[i] * " f " + (x or 0) end"
+      print "  if s > " n " then return \"module " n " function " f "\" end"
+      print "  return { s, x, n = " f ", name = \"f" f "\" }"
+      print "end"
+    }
+    print "return M"
+  }' > "$d/mod$i.sol"
+  i=$((i + 1))
+done
+find "$tmp/src" -name '*.sol' | sort > "$tmp/list"
+
+run () {
+  start=$(date +%s.%N)
+  # shellcheck disable=SC2046
+  "$solc" "$@" $(cat "$tmp/list")
+  end=$(date +%s.%N)
+  echo "$start $end" | awk '{ printf "%.3f s\n", $2 - $1 }'
+}
+
+echo "$files files, $(cat "$tmp"/src/*/*.sol | wc -c) bytes"
+printf "solc        "; run -o "$tmp/seq.out"
+printf "solc -j %-3s " "$jobs"; run -j "$jobs" -o "$tmp/par.out"
+cmp -s "$tmp/seq.out" "$tmp/par.out" || { echo "outputs differ"; exit 1; }
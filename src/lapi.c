@@ -23,6 +23,7 @@
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lsnap.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -900,7 +901,7 @@ static void aux_rawset (sol_State *L, int idx, TValue *key, int n) {
   t = gettable(L, idx);
   solH_set(L, t, key, s2v(L->top.p - 1));
   invalidateTMcache(t);
-  solC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+  solC_barrierslot(L, t, solH_get(t, key), s2v(L->top.p - 1));
   L->top.p -= n;
   sol_unlock(L);
 }
@@ -924,7 +925,7 @@ SOL_API void sol_rawseti (sol_State *L, int idx, sol_Integer n) {
   api_checknelems(L, 1);
   t = gettable(L, idx);
   solH_setint(L, t, n, s2v(L->top.p - 1));
-  solC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+  solC_barrierslot(L, t, solH_getint(t, n), s2v(L->top.p - 1));
   L->top.p--;
   sol_unlock(L);
 }
@@ -1092,7 +1093,7 @@ SOL_API int sol_load (sol_State *L, sol_Reader reader, void *data,
   if (!chunkname) chunkname = "?";
   solZ_init(L, &z, reader, data);
   status = solD_protectedparser(L, &z, chunkname, mode);
-  if (status == SOL_OK) {  /* no errors? */
+  if (status == SOL_OK && ttisLclosure(s2v(L->top.p - 1))) {  /* function? */
     LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
     if (f->nupvalues >= 1) {  /* does it have an upvalue? */
       /* get global table from registry */
@@ -1107,14 +1108,15 @@ SOL_API int sol_load (sol_State *L, sol_Reader reader, void *data,
 }
 
 
-SOL_API int sol_dump (sol_State *L, sol_Writer writer, void *data, int strip) {
+static int dump (sol_State *L, sol_Writer writer, void *data, int strip,
+                 int aligned) {
   int status;
   TValue *o;
   sol_lock(L);
   api_checknelems(L, 1);
   o = s2v(L->top.p - 1);
   if (isLfunction(o))
-    status = solU_dump(L, getproto(o), writer, data, strip);
+    status = solU_dump(L, getproto(o), writer, data, strip, aligned);
   else
     status = 1;
   sol_unlock(L);
@@ -1122,11 +1124,27 @@ SOL_API int sol_dump (sol_State *L, sol_Writer writer, void *data, int strip) {
 }
 
 
+SOL_API int sol_dump (sol_State *L, sol_Writer writer, void *data, int strip) {
+  return dump(L, writer, data, strip, 0);
+}
+
+
+SOL_API int sol_dumpaligned (sol_State *L, sol_Writer writer, void *data,
+                             int strip) {
+  return dump(L, writer, data, strip, 1);
+}
+
+
 SOL_API int sol_status (sol_State *L) {
   return L->status;
 }
 
 
+/* current collector mode, as an option for 'sol_gc' */
+#define gcmode(g)  \
+	((g)->gcadapt ? SOL_GCADAPT : isdecGCmodegen(g) ? SOL_GCGEN : SOL_GCINC)
+
+
 /*
 ** Garbage-collection function
 */
@@ -1199,7 +1217,8 @@ SOL_API int sol_gc (sol_State *L, int what, ...) {
     case SOL_GCGEN: {
       int minormul = va_arg(argp, int);
       int majormul = va_arg(argp, int);
-      res = isdecGCmodegen(g) ? SOL_GCGEN : SOL_GCINC;
+      res = gcmode(g);
+      g->gcadapt = 0;
       if (minormul != 0)
         g->genminormul = minormul;
       if (majormul != 0)
@@ -1211,7 +1230,8 @@ SOL_API int sol_gc (sol_State *L, int what, ...) {
       int pause = va_arg(argp, int);
       int stepmul = va_arg(argp, int);
       int stepsize = va_arg(argp, int);
-      res = isdecGCmodegen(g) ? SOL_GCGEN : SOL_GCINC;
+      res = gcmode(g);
+      g->gcadapt = 0;
       if (pause != 0)
         setgcparam(g->gcpause, pause);
       if (stepmul != 0)
@@ -1221,6 +1241,27 @@ SOL_API int sol_gc (sol_State *L, int what, ...) {
       solC_changemode(L, KGC_INC);
       break;
     }
+    case SOL_GCADAPT: {
+      res = gcmode(g);
+      solC_setadaptive(L, 1);
+      break;
+    }
+    case SOL_GCRELEASE: {
+      solC_fullgc(L, 0);
+      res = solC_release(L);
+      break;
+    }
+    case SOL_GCDEFERFIN: {
+      int on = va_arg(argp, int);
+      res = g->gcdeferfin;  /* previous mode */
+      g->gcdeferfin = (on != 0);
+      break;
+    }
+    case SOL_GCRUNFIN: {
+      int n = va_arg(argp, int);
+      res = solC_runfinalizers(L, n);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1229,6 +1270,37 @@ SOL_API int sol_gc (sol_State *L, int what, ...) {
 }
 
 
+SOL_API void sol_gcstats (sol_State *L, sol_GCStats *st) {
+  sol_lock(L);
+  *st = G(L)->gcstats;
+  sol_unlock(L);
+}
+
+
+SOL_API int sol_snapshot (sol_State *L, sol_Writer writer, void *data) {
+  int status;
+  sol_lock(L);
+  status = solC_snapshot(L, writer, data);
+  sol_unlock(L);
+  return status;
+}
+
+
+SOL_API void sol_setsampler (sol_State *L, sol_SampleFunction f, void *ud,
+                             size_t interval) {
+  global_State *g = G(L);
+  sol_lock(L);
+  if (f == NULL || interval == 0)
+    f = NULL;  /* turn off sampling */
+  if (interval > cast_sizet(MAX_LMEM))
+    interval = cast_sizet(MAX_LMEM);
+  g->samplef = f;
+  g->ud_sample = ud;
+  g->sampleinterval = g->samplecount = cast(l_mem, interval);
+  sol_unlock(L);
+}
+
+
 
 /*
 ** miscellaneous functions
@@ -1332,6 +1404,49 @@ void sol_setwarnf (sol_State *L, sol_WarnFunction f, void *ud) {
 }
 
 
+SOL_API void sol_setreleasef (sol_State *L, sol_ReleaseFunction f, void *ud) {
+  sol_lock(L);
+  G(L)->ud_release = ud;
+  G(L)->releasef = f;
+  sol_unlock(L);
+}
+
+
+SOL_API size_t sol_setmemlimit (sol_State *L, size_t limit) {
+  size_t old;
+  sol_lock(L);
+  old = G(L)->memlimit;
+  if (limit != SOL_QUERYLIMIT)
+    G(L)->memlimit = limit;
+  sol_unlock(L);
+  return old;
+}
+
+
+SOL_API void *sol_atclose (sol_State *L, sol_CloseFunction f, size_t size) {
+  CloseFunc *c;
+  sol_lock(L);
+  if (l_unlikely(size > MAX_SIZE - sizeof(CloseFunc)))
+    solM_toobig(L);
+  c = cast(CloseFunc *, solM_malloc_(L, sizeof(CloseFunc) + size, 0));
+  c->f = f;
+  c->size = size;
+  c->next = G(L)->closefuncs;
+  G(L)->closefuncs = c;
+  sol_unlock(L);
+  return closeblock(c);
+}
+
+
+SOL_API void sol_setiterators (sol_State *L, sol_CFunction next,
+                                             sol_CFunction inext) {
+  sol_lock(L);
+  G(L)->nextf = next;
+  G(L)->inextf = inext;
+  sol_unlock(L);
+}
+
+
 void sol_warning (sol_State *L, const char *msg, int tocont) {
   sol_lock(L);
   solE_warning(L, msg, tocont);
@@ -781,11 +781,130 @@ static int skipcomment (FILE *f, int *cp) {
 }
 
 
+/*
+** {======================================================
+** Mapped chunks: a file loaded with mode 'B' that holds a binary chunk
+** is mapped in memory and loaded from there as a fixed buffer, so that
+** an aligned chunk is used in place (see 'sol_load'). Prototypes (and
+** lazy bodies) from that chunk point into the mapping, and finalizers
+** may still run them while the state is closed, so the mapping is only
+** released after all objects are gone (see 'sol_atclose'). Elsewhere,
+** 'B' is taken as 'b'.
+** =======================================================
+*/
+
+#define MAPPEDKEY	"_MAPPED"
+
+/* replace 'B' by 'b' in a mode for a non-fixed buffer */
+static const char *unfixedmode (const char *mode, char *buff, size_t sz) {
+  size_t i;
+  if (mode == NULL || strchr(mode, 'B') == NULL)
+    return mode;
+  for (i = 0; mode[i] != '\0' && i < sz - 1; i++)
+    buff[i] = (mode[i] == 'B') ? 'b' : mode[i];
+  buff[i] = '\0';
+  return buff;
+}
+
+
+#if defined(SOL_USE_POSIX)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct Mapped {
+  void *addr;
+  size_t size;
+} Mapped;
+
+
+static void unmapchunk (void *ud) {
+  Mapped *m = (Mapped *)ud;
+  munmap(m->addr, m->size);
+}
+
+
+/* releases a mapping not yet handed over to 'unmapchunk' */
+static int gcmapped (sol_State *L) {
+  Mapped *m = (Mapped *)sol_touserdata(L, 1);
+  if (m->addr != NULL) {
+    munmap(m->addr, m->size);
+    m->addr = NULL;
+  }
+  return 0;
+}
+
+
+/*
+** Try to load 'filename' as a mapped binary chunk. Returns -1, with the
+** stack unchanged, if the file cannot be mapped or is not binary;
+** otherwise, returns the status of the load.
+*/
+static int loadmapped (sol_State *L, const char *filename,
+                       const char *chunkname, const char *mode) {
+  struct stat st;
+  Mapped *m;
+  void *addr;
+  int status;
+  int fd;
+  /* create the userdata first, so that no error can leak 'fd' */
+  m = (Mapped *)sol_newuserdatauv(L, sizeof(Mapped), 0);
+  m->addr = NULL;
+  m->size = 0;
+  if (solL_newmetatable(L, MAPPEDKEY)) {
+    sol_pushcfunction(L, gcmapped);
+    sol_setfield(L, -2, "__gc");
+  }
+  sol_setmetatable(L, -2);
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    sol_pop(L, 1);
+    return -1;
+  }
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    sol_pop(L, 1);
+    return -1;
+  }
+  m->size = (size_t)st.st_size;
+  addr = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    sol_pop(L, 1);
+    return -1;
+  }
+  m->addr = addr;
+  if (*(const char *)addr != SOL_SIGNATURE[0]) {  /* not a binary chunk? */
+    sol_pop(L, 1);  /* collector will unmap it */
+    return -1;
+  }
+  status = solL_loadbufferx(L, (const char *)addr, m->size, chunkname, mode);
+  if (status == SOL_OK) {  /* keep the mapping until the state is closed */
+    Mapped *c = (Mapped *)sol_atclose(L, unmapchunk, sizeof(Mapped));
+    *c = *m;
+    m->addr = NULL;  /* now owned by 'unmapchunk' */
+  }
+  sol_remove(L, -2);  /* remove mapping from the stack */
+  return status;
+}
+
+#else
+
+#define loadmapped(L,fn,cn,m)	((void)(L), (void)(fn), (void)(cn), (void)(m), -1)
+
+#endif
+
+/* }====================================================== */
+
+
 SOLLIB_API int solL_loadfilex (sol_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
+  char mbuff[8];
   int fnameindex = sol_gettop(L) + 1;  /* index of filename on the stack */
   if (filename == NULL) {
     sol_pushliteral(L, "=stdin");
@@ -793,6 +912,13 @@ SOLLIB_API int solL_loadfilex (sol_State *L, const char *filename,
   }
   else {
     sol_pushfstring(L, "@%s", filename);
+    if (mode != NULL && strchr(mode, 'B') != NULL) {  /* try to map it */
+      status = loadmapped(L, filename, sol_tostring(L, -1), mode);
+      if (status >= 0) {
+        sol_remove(L, fnameindex);
+        return status;
+      }
+    }
     errno = 0;
     lf.f = fopen(filename, "r");
     if (lf.f == NULL) return errfile(L, "open", fnameindex);
@@ -812,6 +938,7 @@ SOLLIB_API int solL_loadfilex (sol_State *L, const char *filename,
   if (c != EOF)
     lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
   errno = 0;
+  mode = unfixedmode(mode, mbuff, sizeof(mbuff));
   status = sol_load(L, getF, &lf, sol_tostring(L, -1), mode);
   readstatus = ferror(lf.f);
   if (filename) fclose(lf.f);  /* close file (even in case of errors) */
@@ -1034,6 +1161,30 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
 }
 
 
+/*
+** Release function for 'l_alloc': glibc keeps freed pages in its arenas
+** and only trims the top of the main heap by itself; 'malloc_trim' also
+** gives back free pages in the middle of all arenas. Other C libraries
+** have no portable way to do that, so they get no release function.
+*/
+#if defined(__GLIBC__)
+
+#include <malloc.h>
+
+static int l_release (void *ud, size_t inuse) {
+  (void)ud; (void)inuse;  /* not used */
+  return malloc_trim(0);
+}
+
+#define l_setrelease(L)		sol_setreleasef(L, l_release, NULL)
+
+#else
+
+#define l_setrelease(L)		((void)0)
+
+#endif
+
+
 /*
 ** Standard panic funcion just prints an error message. The test
 ** with 'sol_type' avoids possible memory errors in 'sol_tostring'.
@@ -1110,6 +1261,7 @@ SOLLIB_API sol_State *solL_newstate (void) {
   if (l_likely(L)) {
     sol_atpanic(L, &panic);
     sol_setwarnf(L, warnfoff, L);  /* default is warnings off */
+    l_setrelease(L);
   }
   return L;
 }
@@ -117,6 +117,9 @@ SOLLIB_API void (solL_traceback) (sol_State *L, sol_State *L1,
 SOLLIB_API void (solL_requiref) (sol_State *L, const char *modname,
                                  sol_CFunction openf, int glb);
 
+SOLLIB_API int (solL_saveimage) (sol_State *L, const char *filename);
+SOLLIB_API int (solL_loadimage) (sol_State *L, const char *filename);
+
 /*
 ** ===============================================================
 ** some useful macros
@@ -186,7 +186,8 @@ static int pushmode (sol_State *L, int oldmode) {
     solL_pushfail(L);  /* invalid call to 'sol_gc' */
   else
     sol_pushstring(L, (oldmode == SOL_GCINC) ? "incremental"
-                                             : "generational");
+                    : (oldmode == SOL_GCGEN) ? "generational"
+                    : "adaptive");
   return 1;
 }
 
@@ -196,13 +197,105 @@ static int pushmode (sol_State *L, int oldmode) {
 */
 #define checkvalres(res) { if (res == -1) break; }
 
+
+/* pseudo-options for 'collectgarbage' not handled by 'sol_gc' */
+#define GCOPT_STATS	(-1)
+#define GCOPT_SNAPSHOT	(-2)
+#define GCOPT_LIMIT	(-3)
+
+
+static void setnumfield (sol_State *L, const char *k, sol_Number v) {
+  sol_pushnumber(L, v);
+  sol_setfield(L, -2, k);
+}
+
+
+static void setintfield (sol_State *L, const char *k, size_t v) {
+  sol_pushinteger(L, (sol_Integer)v);
+  sol_setfield(L, -2, k);
+}
+
+
+/*
+** Push a table with the collector statistics (see 'sol_GCStats').
+*/
+static int pushgcstats (sol_State *L) {
+  static const char *const phases[SOL_GCPHASES] =
+    {"propagate", "atomic", "sweep", "callfin"};
+  sol_GCStats st;
+  int i;
+  sol_gcstats(L, &st);
+  sol_createtable(L, 0, 12);
+  sol_createtable(L, 0, SOL_GCPHASES);
+  for (i = 0; i < SOL_GCPHASES; i++)
+    setnumfield(L, phases[i], st.phasetime[i]);
+  sol_setfield(L, -2, "phases");
+  sol_createtable(L, SOL_GCPAUSEBINS, 0);
+  for (i = 0; i < SOL_GCPAUSEBINS; i++) {
+    sol_pushinteger(L, (sol_Integer)st.pausehist[i]);
+    sol_rawseti(L, -2, i + 1);
+  }
+  sol_setfield(L, -2, "pausehist");
+  sol_createtable(L, 0, SOL_GCNTYPES);
+  for (i = 0; i < SOL_GCNTYPES; i++) {
+    if (st.nfreed[i] > 0)
+      setintfield(L, (i < SOL_NUMTYPES) ? sol_typename(L, i)
+                                        : (i == SOL_NUMTYPES) ? "upvalue"
+                                                              : "proto",
+                     st.nfreed[i]);
+  }
+  sol_setfield(L, -2, "freed");
+  setnumfield(L, "pausetime", st.pausetime);
+  setnumfield(L, "maxpause", st.maxpause);
+  setintfield(L, "pauses", st.npauses);
+  setintfield(L, "minor", st.nminor);
+  setintfield(L, "major", st.nmajor);
+  setintfield(L, "emergency", st.nemergency);
+  setintfield(L, "releases", st.nreleases);
+  setintfield(L, "pendingfin", st.pendingfin);
+  setintfield(L, "stackgrows", st.nstackgrow);
+  setintfield(L, "stackshrinks", st.nstackshrink);
+  setintfield(L, "cichunks", st.ncichunks);
+  setintfield(L, "marked", st.bytesmarked);
+  setintfield(L, "swept", st.bytesswept);
+  return 1;
+}
+
+
+static int writesnap (sol_State *L, const void *b, size_t size, void *f) {
+  (void)L;
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** Write a heap snapshot to file 'fname' (see 'sol_snapshot').
+*/
+static int gcsnapshot (sol_State *L) {
+  const char *fname = solL_checkstring(L, 2);
+  FILE *f = fopen(fname, "wb");
+  int status;
+  if (f == NULL)
+    return solL_fileresult(L, 0, fname);
+  status = sol_snapshot(L, writesnap, f);
+  if (fclose(f) != 0 || status != 0)
+    return solL_fileresult(L, 0, fname);
+  sol_pushboolean(L, 1);
+  return 1;
+}
+
+
 static int solB_collectgarbage (sol_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "adaptive", "stats",
+    "snapshot", "release", "limit", "deferfinalizers", "runfinalizers",
+    NULL};
   static const int optsnum[] = {SOL_GCSTOP, SOL_GCRESTART, SOL_GCCOLLECT,
     SOL_GCCOUNT, SOL_GCSTEP, SOL_GCSETPAUSE, SOL_GCSETSTEPMUL,
-    SOL_GCISRUNNING, SOL_GCGEN, SOL_GCINC};
+    SOL_GCISRUNNING, SOL_GCGEN, SOL_GCINC, SOL_GCADAPT, GCOPT_STATS,
+    GCOPT_SNAPSHOT, SOL_GCRELEASE, GCOPT_LIMIT, SOL_GCDEFERFIN,
+    SOL_GCRUNFIN};
   int o = optsnum[solL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case SOL_GCCOUNT: {
@@ -227,7 +320,22 @@ static int solB_collectgarbage (sol_State *L) {
       sol_pushinteger(L, previous);
       return 1;
     }
-    case SOL_GCISRUNNING: {
+    case SOL_GCDEFERFIN: {
+      int on = sol_toboolean(L, 2);
+      int previous = sol_gc(L, o, on);
+      checkvalres(previous);
+      sol_pushboolean(L, previous);
+      return 1;
+    }
+    case SOL_GCRUNFIN: {
+      int n = (int)solL_optinteger(L, 2, 0);
+      int res = sol_gc(L, o, n);
+      checkvalres(res);
+      sol_pushinteger(L, res);
+      return 1;
+    }
+    case SOL_GCISRUNNING:
+    case SOL_GCRELEASE: {
       int res = sol_gc(L, o);
       checkvalres(res);
       sol_pushboolean(L, res);
@@ -244,6 +352,27 @@ static int solB_collectgarbage (sol_State *L) {
       int stepsize = (int)solL_optinteger(L, 4, 0);
       return pushmode(L, sol_gc(L, o, pause, stepmul, stepsize));
     }
+    case SOL_GCADAPT: {
+      return pushmode(L, sol_gc(L, o));
+    }
+    case GCOPT_STATS: {
+      return pushgcstats(L);
+    }
+    case GCOPT_SNAPSHOT: {
+      return gcsnapshot(L);
+    }
+    case GCOPT_LIMIT: {
+      size_t old;
+      if (sol_isnoneornil(L, 2))  /* only query the limit? */
+        old = sol_setmemlimit(L, SOL_QUERYLIMIT);
+      else {
+        sol_Integer limit = solL_checkinteger(L, 2);
+        solL_argcheck(L, limit >= 0, 2, "limit must be non-negative");
+        old = sol_setmemlimit(L, (size_t)limit);
+      }
+      sol_pushinteger(L, (sol_Integer)old);
+      return 1;
+    }
     default: {
       int res = sol_gc(L, o);
       checkvalres(res);
@@ -390,6 +519,8 @@ static int solB_load (sol_State *L) {
   const char *s = sol_tolstring(L, 1, &l);
   const char *mode = solL_optstring(L, 3, "bt");
   int env = (!sol_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
+  solL_argcheck(L, strchr(mode, 'B') == NULL, 3,
+                   "mode 'B' is only valid for files");
   if (s != NULL) {  /* loading a string? */
     const char *chunkname = solL_optstring(L, 2, s);
     status = solL_loadbufferx(L, s, l, chunkname, mode);
@@ -544,6 +675,7 @@ SOLMOD_API int solopen_base (sol_State *L) {
   /* set global _VERSION */
   sol_pushliteral(L, SOL_VERSION);
   sol_setfield(L, -2, "_VERSION");
+  sol_setiterators(L, solB_next, ipairsaux);
   return 1;
 }
 
@@ -25,18 +25,43 @@ static sol_State *getco (sol_State *L) {
 }
 
 
+/*
+** 'coroutine.transfer' yields this marker, followed by the target
+** coroutine and the values for it.
+*/
+static const char transferkey = 't';
+
+#define istransfer(co,nres)  \
+	((nres) >= 2 && sol_touserdata(co, -(nres)) == &transferkey)
+
+
 /*
 ** Resumes a coroutine. Returns the number of results for non-error
-** cases or -1 for errors.
+** cases or -1 for errors. When the coroutine transfers control to
+** another one, that one is resumed in its place (and '*pco' is
+** updated), so that transfers do not nest.
 */
-static int auxresume (sol_State *L, sol_State *co, int narg) {
+static int auxresume (sol_State *L, sol_State **pco, int narg) {
+  sol_State *from = L;  /* thread holding the values for 'co' */
+  sol_State *co = *pco;
   int status, nres;
-  if (l_unlikely(!sol_checkstack(co, narg))) {
-    sol_pushliteral(L, "too many arguments to resume");
-    return -1;  /* error flag */
+  for (;;) {
+    if (l_unlikely(!sol_checkstack(co, narg))) {
+      sol_pushliteral(L, "too many arguments to resume");
+      return -1;  /* error flag */
+    }
+    if (from != L) {  /* transfer? */
+      sol_rotate(from, -(narg + 2), -2);  /* move marker and target up */
+      sol_pop(from, 2);  /* and remove them */
+    }
+    sol_xmove(from, co, narg);  /* (nothing to move if 'from' is 'co') */
+    status = sol_resume(co, L, narg, &nres);
+    if (l_likely(status != SOL_YIELD || !istransfer(co, nres)))
+      break;
+    from = co;
+    co = *pco = sol_tothread(co, -(nres - 1));
+    narg = nres - 2;
   }
-  sol_xmove(L, co, narg);
-  status = sol_resume(co, L, narg, &nres);
   if (l_likely(status == SOL_OK || status == SOL_YIELD)) {
     if (l_unlikely(!sol_checkstack(L, nres + 1))) {
       sol_pop(co, nres);  /* remove results anyway */
@@ -56,7 +81,7 @@ static int auxresume (sol_State *L, sol_State *co, int narg) {
 static int solB_coresume (sol_State *L) {
   sol_State *co = getco(L);
   int r;
-  r = auxresume(L, co, sol_gettop(L) - 1);
+  r = auxresume(L, &co, sol_gettop(L) - 1);
   if (l_unlikely(r < 0)) {
     sol_pushboolean(L, 0);
     sol_insert(L, -2);
@@ -72,7 +97,7 @@ static int solB_coresume (sol_State *L) {
 
 static int solB_auxwrap (sol_State *L) {
   sol_State *co = sol_tothread(L, sol_upvalueindex(1));
-  int r = auxresume(L, co, sol_gettop(L));
+  int r = auxresume(L, &co, sol_gettop(L));
   if (l_unlikely(r < 0)) {  /* error? */
     int stat = sol_status(co);
     if (stat != SOL_OK && stat != SOL_YIELD) {  /* error in the coroutine? */
@@ -114,6 +139,19 @@ static int solB_yield (sol_State *L) {
 }
 
 
+/*
+** Suspends the running coroutine and resumes 'co' with the other
+** arguments; whoever resumed the running coroutine resumes 'co'
+** instead (see 'auxresume').
+*/
+static int solB_transfer (sol_State *L) {
+  getco(L);  /* check target */
+  sol_pushlightuserdata(L, (void *)&transferkey);
+  sol_insert(L, 1);
+  return sol_yield(L, sol_gettop(L));
+}
+
+
 #define COS_RUN		0
 #define COS_DEAD	1
 #define COS_YIELD	2
@@ -196,6 +234,7 @@ static const solL_Reg co_funcs[] = {
   {"status", solB_costatus},
   {"wrap", solB_cowrap},
   {"yield", solB_yield},
+  {"transfer", solB_transfer},
   {"isyieldable", solB_yieldable},
   {"close", solB_close},
   {NULL, NULL}
@@ -454,6 +454,421 @@ static int db_setcstacklimit (sol_State *L) {
 }
 
 
+/*
+** {======================================================
+** Allocation profiler
+** =======================================================
+*/
+
+/*
+** The profiler lives in a userdata at registry[PROFKEY]. Its tables
+** are allocated directly with the state allocator, outside the
+** collector, because they are updated from inside allocations and
+** deallocations, where no Sol object can be created.
+*/
+static const char *const PROFKEY = "_ALLOCPROF";
+
+#define PROF_INTERVAL	(512 * 1024)	/* default sampling interval */
+#define PROF_MAXDEPTH	32	/* maximum number of frames per stack */
+#define PROF_FRAMELEN	120	/* maximum length of one frame */
+#define PROF_STACKLEN	(PROF_MAXDEPTH * PROF_FRAMELEN)
+
+
+typedef struct ProfStack {  /* a distinct folded stack */
+  char *name;  /* frames from root to leaf, separated by ';' */
+  size_t len;  /* length of 'name' */
+  unsigned int hash;
+  size_t nalloc;  /* number of samples taken here */
+  size_t allocbytes;  /* estimated bytes allocated here */
+  size_t livebytes;  /* estimated bytes still alive */
+} ProfStack;
+
+
+typedef struct ProfSample {  /* a sampled object not yet freed */
+  const void *p;  /* object (NULL if slot is empty) */
+  size_t stack;  /* index of its stack in 'stacks' */
+  size_t bytes;  /* estimated bytes it stands for */
+} ProfSample;
+
+
+typedef struct AllocProf {
+  sol_Alloc allocf;
+  void *ud;  /* auxiliary data to 'allocf' */
+  size_t interval;
+  int running;  /* true while installed as the state sampler */
+  size_t dropped;  /* samples lost for lack of memory */
+  ProfStack *stacks;
+  size_t nstacks, sizestacks;
+  size_t *stackidx;  /* hash index into 'stacks' (entry is index + 1) */
+  size_t sizeidx;
+  ProfSample *samples;  /* hash set of live samples */
+  size_t nsamples, sizesamples;
+} AllocProf;
+
+
+static void *profrealloc (AllocProf *ap, void *block, size_t osize,
+                                                     size_t nsize) {
+  return ap->allocf(ap->ud, block, osize, nsize);
+}
+
+
+static unsigned int hashstring (const char *s, size_t l) {
+  unsigned int h = 2166136261u;
+  while (l--)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+
+#define hashptr(p,size)  \
+	((size_t)(((size_t)(p) >> 4) * 2654435761u) & ((size) - 1))
+
+
+/*
+** Rebuild the stack index with 'nsize' slots (a power of 2).
+*/
+static int resizestackidx (AllocProf *ap, size_t nsize) {
+  size_t i;
+  size_t *idx = (size_t *)profrealloc(ap, NULL, 0, nsize * sizeof(size_t));
+  if (idx == NULL) return 0;
+  memset(idx, 0, nsize * sizeof(size_t));
+  for (i = 0; i < ap->nstacks; i++) {
+    size_t j = ap->stacks[i].hash & (nsize - 1);
+    while (idx[j] != 0) j = (j + 1) & (nsize - 1);
+    idx[j] = i + 1;
+  }
+  profrealloc(ap, ap->stackidx, ap->sizeidx * sizeof(size_t), 0);
+  ap->stackidx = idx;
+  ap->sizeidx = nsize;
+  return 1;
+}
+
+
+/*
+** Find (or create) the entry for stack 'name'. Returns its index, or
+** (size_t)-1 when out of memory.
+*/
+static size_t findstack (AllocProf *ap, const char *name, size_t len) {
+  unsigned int h = hashstring(name, len);
+  size_t j;
+  ProfStack *st;
+  if (ap->nstacks + 1 > ap->sizeidx / 2 &&
+      !resizestackidx(ap, (ap->sizeidx == 0) ? 64 : ap->sizeidx * 2))
+    return (size_t)-1;
+  for (j = h & (ap->sizeidx - 1); ap->stackidx[j] != 0;
+       j = (j + 1) & (ap->sizeidx - 1)) {
+    st = &ap->stacks[ap->stackidx[j] - 1];
+    if (st->hash == h && st->len == len && memcmp(st->name, name, len) == 0)
+      return ap->stackidx[j] - 1;
+  }
+  if (ap->nstacks == ap->sizestacks) {  /* grow 'stacks'? */
+    size_t nsize = (ap->sizestacks == 0) ? 32 : ap->sizestacks * 2;
+    ProfStack *ns = (ProfStack *)profrealloc(ap, ap->stacks,
+                                             ap->sizestacks * sizeof(ProfStack),
+                                             nsize * sizeof(ProfStack));
+    if (ns == NULL) return (size_t)-1;
+    ap->stacks = ns;
+    ap->sizestacks = nsize;
+  }
+  st = &ap->stacks[ap->nstacks];
+  st->name = (char *)profrealloc(ap, NULL, 0, len);
+  if (st->name == NULL) return (size_t)-1;
+  memcpy(st->name, name, len);
+  st->len = len;
+  st->hash = h;
+  st->nalloc = st->allocbytes = st->livebytes = 0;
+  ap->stackidx[j] = ap->nstacks + 1;
+  return ap->nstacks++;
+}
+
+
+static void insertsample (ProfSample *samples, size_t size,
+                          const ProfSample *sp) {
+  size_t j = hashptr(sp->p, size);
+  while (samples[j].p != NULL) j = (j + 1) & (size - 1);
+  samples[j] = *sp;
+}
+
+
+static int addsample (AllocProf *ap, const ProfSample *sp) {
+  if (ap->nsamples + 1 > ap->sizesamples / 2) {  /* grow hash set? */
+    size_t i;
+    size_t nsize = (ap->sizesamples == 0) ? 64 : ap->sizesamples * 2;
+    ProfSample *ns = (ProfSample *)profrealloc(ap, NULL, 0,
+                                               nsize * sizeof(ProfSample));
+    if (ns == NULL) return 0;
+    memset(ns, 0, nsize * sizeof(ProfSample));
+    for (i = 0; i < ap->sizesamples; i++) {
+      if (ap->samples[i].p != NULL)
+        insertsample(ns, nsize, &ap->samples[i]);
+    }
+    profrealloc(ap, ap->samples, ap->sizesamples * sizeof(ProfSample), 0);
+    ap->samples = ns;
+    ap->sizesamples = nsize;
+  }
+  insertsample(ap->samples, ap->sizesamples, sp);
+  ap->nsamples++;
+  return 1;
+}
+
+
+/* index of the sample for block 'p', or -1 if 'p' was not sampled */
+static size_t findsample (AllocProf *ap, const void *p) {
+  size_t mask = ap->sizesamples - 1;
+  size_t i;
+  if (ap->nsamples == 0) return (size_t)-1;
+  for (i = hashptr(p, ap->sizesamples); ap->samples[i].p != p;
+       i = (i + 1) & mask) {
+    if (ap->samples[i].p == NULL)
+      return (size_t)-1;  /* block was not sampled */
+  }
+  return i;
+}
+
+
+/*
+** Delete the sample at index 'i'. (Uses backward-shift deletion to keep
+** the probe sequences of the other entries intact.)
+*/
+static void deletesample (AllocProf *ap, size_t i) {
+  size_t mask = ap->sizesamples - 1;
+  size_t j;
+  ap->nsamples--;
+  for (j = (i + 1) & mask; ap->samples[j].p != NULL; j = (j + 1) & mask) {
+    size_t home = hashptr(ap->samples[j].p, ap->sizesamples);
+    if (((j - home) & mask) >= ((j - i) & mask)) {  /* can move to 'i'? */
+      ap->samples[i] = ap->samples[j];
+      i = j;
+    }
+  }
+  ap->samples[i].p = NULL;
+}
+
+
+/*
+** Remove the sample for block 'p', if there is one, and discount it
+** from its stack.
+*/
+static void removesample (AllocProf *ap, const void *p) {
+  size_t i = findsample(ap, p);
+  if (i != (size_t)-1) {
+    ap->stacks[ap->samples[i].stack].livebytes -= ap->samples[i].bytes;
+    deletesample(ap, i);
+  }
+}
+
+
+/* a sampled block 'op' now lives at 'p': move its sample */
+static void movesample (AllocProf *ap, const void *op, const void *p) {
+  size_t i = findsample(ap, op);
+  if (i != (size_t)-1) {
+    ProfSample sample = ap->samples[i];
+    deletesample(ap, i);
+    sample.p = p;
+    insertsample(ap->samples, ap->sizesamples, &sample);
+    ap->nsamples++;
+  }
+}
+
+
+/*
+** Append 's' to the 'len' bytes in 'buff', without going over 'max'
+** bytes. (The sampler runs inside an allocation, so it cannot build
+** strings with the API.)
+*/
+static size_t addpart (char *buff, size_t len, size_t max, const char *s) {
+  while (*s != '\0' && len < max)
+    buff[len++] = *s++;
+  return len;
+}
+
+
+/*
+** Write the stack of 'L' in folded format (root first) into 'buff',
+** ending with the type of the allocated object (or "block", for other
+** memory) as a pseudo-frame.
+*/
+static size_t foldstack (sol_State *L, char *buff, int tt) {
+  static const char *const itypes[] = {"upvalue", "proto"};
+  char frames[PROF_MAXDEPTH][PROF_FRAMELEN];
+  size_t flen[PROF_MAXDEPTH];
+  sol_Debug ar;
+  size_t len = 0;
+  int n = 0;
+  while (n < PROF_MAXDEPTH - 1 && sol_getstack(L, n, &ar)) {
+    const char *name;
+    size_t l;
+    sol_getinfo(L, "Sln", &ar);
+    name = (ar.name != NULL) ? ar.name : (*ar.what == 'm') ? "main" : "?";
+    l = addpart(frames[n], 0, PROF_FRAMELEN, name);
+    l = addpart(frames[n], l, PROF_FRAMELEN, "@");
+    l = addpart(frames[n], l, PROF_FRAMELEN, ar.short_src);
+    if (ar.currentline > 0) {
+      char line[24];
+      l_sprintf(line, sizeof(line), ":%d", ar.currentline);
+      l = addpart(frames[n], l, PROF_FRAMELEN, line);
+    }
+    flen[n++] = l;
+  }
+  while (n-- > 0) {  /* from root to leaf */
+    memcpy(buff + len, frames[n], flen[n]);
+    len += flen[n];
+    buff[len++] = ';';
+  }
+  len = addpart(buff, len, len + PROF_FRAMELEN, "[");
+  len = addpart(buff, len, len + PROF_FRAMELEN,
+                (tt == SOL_TNONE) ? "block"
+                : (tt < SOL_NUMTYPES) ? sol_typename(L, tt)
+                : itypes[tt - SOL_NUMTYPES]);
+  len = addpart(buff, len, len + PROF_FRAMELEN, "]");
+  return len;
+}
+
+
+static void profsampler (void *ud, sol_State *L, const void *p,
+                         const void *op, int tt, size_t sz) {
+  AllocProf *ap = (AllocProf *)ud;
+  if (op != NULL) {  /* block freed or resized? */
+    if (p == NULL)
+      removesample(ap, op);
+    else if (p != op)
+      movesample(ap, op, p);
+  }
+  else {
+    char buff[PROF_STACKLEN + PROF_FRAMELEN];
+    ProfSample sample;
+    size_t len = foldstack(L, buff, tt);
+    removesample(ap, p);  /* growth of a block already sampled? */
+    sample.p = p;
+    sample.stack = findstack(ap, buff, len);
+    sample.bytes = (sz > ap->interval) ? sz : ap->interval;
+    if (sample.stack == (size_t)-1 || !addsample(ap, &sample))
+      ap->dropped++;
+    else {
+      ProfStack *st = &ap->stacks[sample.stack];
+      st->nalloc++;
+      st->allocbytes += sample.bytes;
+      st->livebytes += sample.bytes;
+    }
+  }
+}
+
+
+static void clearprofile (AllocProf *ap) {
+  size_t i;
+  for (i = 0; i < ap->nstacks; i++)
+    profrealloc(ap, ap->stacks[i].name, ap->stacks[i].len, 0);
+  profrealloc(ap, ap->stacks, ap->sizestacks * sizeof(ProfStack), 0);
+  profrealloc(ap, ap->stackidx, ap->sizeidx * sizeof(size_t), 0);
+  profrealloc(ap, ap->samples, ap->sizesamples * sizeof(ProfSample), 0);
+  ap->stacks = NULL;
+  ap->stackidx = NULL;
+  ap->samples = NULL;
+  ap->nstacks = ap->sizestacks = ap->sizeidx = 0;
+  ap->nsamples = ap->sizesamples = 0;
+  ap->dropped = 0;
+}
+
+
+static void stopprofile (sol_State *L, AllocProf *ap) {
+  if (ap->running) {
+    sol_setsampler(L, NULL, NULL, 0);
+    ap->running = 0;
+  }
+}
+
+
+static int prof_gc (sol_State *L) {
+  AllocProf *ap = (AllocProf *)sol_touserdata(L, 1);
+  stopprofile(L, ap);
+  clearprofile(ap);
+  return 0;
+}
+
+
+/*
+** Get the profiler from the registry, creating it if 'create' is
+** true. Returns NULL if there is no profiler.
+*/
+static AllocProf *getprofile (sol_State *L, int create) {
+  AllocProf *ap;
+  if (sol_getfield(L, SOL_REGISTRYINDEX, PROFKEY) != SOL_TNIL || !create) {
+    ap = (AllocProf *)sol_touserdata(L, -1);
+    sol_pop(L, 1);
+    return ap;
+  }
+  sol_pop(L, 1);
+  ap = (AllocProf *)sol_newuserdatauv(L, sizeof(AllocProf), 0);
+  memset(ap, 0, sizeof(AllocProf));
+  ap->allocf = sol_getallocf(L, &ap->ud);
+  sol_createtable(L, 0, 1);
+  sol_pushcfunction(L, prof_gc);
+  sol_setfield(L, -2, "__gc");
+  sol_setmetatable(L, -2);
+  sol_setfield(L, SOL_REGISTRYINDEX, PROFKEY);
+  return ap;
+}
+
+
+/*
+** Push the profile in folded-stack format: one line per stack, with
+** the estimated bytes allocated there (or still alive, if 'live').
+*/
+static void pushprofile (sol_State *L, AllocProf *ap, int live) {
+  solL_Buffer b;
+  size_t i;
+  solL_buffinit(L, &b);
+  if (ap != NULL) {
+    for (i = 0; i < ap->nstacks; i++) {
+      ProfStack *st = &ap->stacks[i];
+      size_t bytes = live ? st->livebytes : st->allocbytes;
+      if (bytes > 0) {
+        char num[32];
+        solL_addlstring(&b, st->name, st->len);
+        l_sprintf(num, sizeof(num), " %lu\n", (unsigned long)bytes);
+        solL_addstring(&b, num);
+      }
+    }
+  }
+  solL_pushresult(&b);
+}
+
+
+static int db_allocprofile (sol_State *L) {
+  static const char *const opts[] = {"start", "stop", "alloc", "live", NULL};
+  int o = solL_checkoption(L, 1, NULL, opts);
+  switch (o) {
+    case 0: {  /* start */
+      sol_Integer interval = solL_optinteger(L, 2, PROF_INTERVAL);
+      AllocProf *ap;
+      solL_argcheck(L, interval > 0, 2, "interval must be positive");
+      ap = getprofile(L, 1);
+      stopprofile(L, ap);
+      clearprofile(ap);
+      ap->interval = (size_t)interval;
+      sol_setsampler(L, profsampler, ap, ap->interval);
+      ap->running = 1;
+      return 0;
+    }
+    case 1: {  /* stop */
+      AllocProf *ap = getprofile(L, 0);
+      if (ap != NULL) {
+        stopprofile(L, ap);
+        sol_pushinteger(L, (sol_Integer)ap->dropped);
+        return 1;
+      }
+      return 0;
+    }
+    default: {  /* alloc/live */
+      pushprofile(L, getprofile(L, 0), o == 3);
+      return 1;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
 static const solL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -472,6 +887,7 @@ static const solL_Reg dblib[] = {
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
   {"setcstacklimit", db_setcstacklimit},
+  {"allocprofile", db_allocprofile},
   {NULL, NULL}
 };
 
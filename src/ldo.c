@@ -48,7 +48,9 @@
 ** SOLI_THROW/SOLI_TRY define how Sol does exception handling. By
 ** default, Sol handles errors with exceptions when compiling as
 ** C++ code, with _longjmp/_setjmp when asked to use them, and with
-** longjmp/setjmp otherwise.
+** longjmp/setjmp otherwise. (C++ exceptions cost nothing when no error
+** is raised, as the compiler unwinds the stack with tables, but are
+** much slower to raise; 'make linux-cxx' builds Sol that way.)
 */
 #if !defined(SOLI_THROW)				/* { */
 
@@ -235,9 +237,16 @@ int solD_reallocstack (sol_State *L, int newsize, int raiseerror) {
   }
   L->stack.p = newstack;
   correctstack(L);  /* change offsets back to pointers */
+  if (newsize > oldsize)
+    G(L)->gcstats.nstackgrow++;
+  else
+    G(L)->gcstats.nstackshrink++;
   L->stack_last.p = L->stack.p + newsize;
   for (i = oldsize + EXTRA_STACK; i < newsize + EXTRA_STACK; i++)
     setnilvalue(s2v(newstack + i)); /* erase new segment */
+  if (newsize > oldsize)  /* growth not sampled while stack was invalid */
+    solM_sample(L, newstack, SOL_TNONE,
+                cast_sizet(newsize - oldsize) * sizeof(StackValue));
   return 1;
 }
 
@@ -298,11 +307,13 @@ static int stackinuse (sol_State *L) {
 /*
 ** If stack size is more than 3 times the current use, reduce that size
 ** to twice the current use. (So, the final stack size is at most 2/3 the
-** previous size, and half of its entries are empty.)
+** previous size, and half of its entries are empty.) This is done only
+** after the stack was found oversized SOLI_SHRINKDELAY times in a row;
+** the CallInfo list is shrunk with the stack.
 ** As a particular case, if stack was handling a stack overflow and now
 ** it is not, 'max' (limited by SOLI_MAXSTACK) will be smaller than
 ** stacksize (equal to ERRORSTACKSIZE in this case), and so the stack
-** will be reduced to a "regular" size.
+** will be reduced to a "regular" size at once.
 */
 void solD_shrinkstack (sol_State *L) {
   int inuse = stackinuse(L);
@@ -310,12 +321,19 @@ void solD_shrinkstack (sol_State *L) {
   /* if thread is currently not handling a stack overflow and its
      size is larger than maximum "reasonable" size, shrink it */
   if (inuse <= SOLI_MAXSTACK && stacksize(L) > max) {
-    int nsize = (inuse > SOLI_MAXSTACK / 2) ? SOLI_MAXSTACK : inuse * 2;
-    solD_reallocstack(L, nsize, 0);  /* ok if that fails */
+    if (stacksize(L) > SOLI_MAXSTACK ||
+        ++L->stackidle >= SOLI_SHRINKDELAY) {
+      int nsize = (inuse > SOLI_MAXSTACK / 2) ? SOLI_MAXSTACK : inuse * 2;
+      L->stackidle = 0;
+      solD_reallocstack(L, nsize, 0);  /* ok if that fails */
+      solE_shrinkCI(L);  /* shrink CI list */
+    }
   }
-  else  /* don't change stack */
+  else {  /* don't change stack */
+    L->stackidle = 0;
     condmovestack(L,{},{});  /* (change only for debugging) */
-  solE_shrinkCI(L);  /* shrink CI list */
+    solE_shrinkCI(L);  /* shrink CI list */
+  }
 }
 
 
@@ -535,6 +553,8 @@ l_sinline int precallC (sol_State *L, StkId func, int nresults,
   sol_unlock(L);
   n = (*f)(L);  /* do the actual call */
   sol_lock(L);
+  if (l_unlikely(L->status == SOL_YIELD))  /* direct yield? */
+    return n;  /* leave everything as it is (see 'sol_yieldk') */
   api_checknelems(L, n);
   solD_poscall(L, ci, n);
   return n;
@@ -688,7 +708,8 @@ static int finishpcallk (sol_State *L,  CallInfo *ci) {
     L->allowhook = getoah(ci->callstatus);  /* restore 'allowhook' */
     func = solF_close(L, func, status, 1);  /* can yield or raise an error */
     solD_seterrorobj(L, status, func);
-    solD_shrinkstack(L);   /* restore stack size in case of overflow */
+    if (stacksize(L) > SOLI_MAXSTACK)  /* was handling an overflow? */
+      solD_shrinkstack(L);  /* restore stack size */
     setcistrecst(ci, SOL_OK);  /* clear original status */
   }
   ci->callstatus &= ~CIST_YPCALL;
@@ -727,7 +748,9 @@ static void finishCcall (sol_State *L, CallInfo *ci) {
       status = finishpcallk(L, ci);  /* finish it */
     adjustresults(L, SOL_MULTRET);  /* finish 'sol_callk' */
     sol_unlock(L);
+    L->nCcalls++;  /* continuations cannot yield directly */
     n = (*ci->u.c.k)(L, status, ci->u.c.ctx);  /* call continuation */
+    L->nCcalls--;
     sol_lock(L);
     api_checknelems(L, n);
   }
@@ -749,6 +772,8 @@ static void unroll (sol_State *L, void *ud) {
     else {  /* Sol function */
       solV_finishOp(L);  /* finish interrupted instruction */
       solV_execute(L, ci);  /* execute down to higher C 'boundary' */
+      if (l_unlikely(L->status == SOL_YIELD))
+        return;  /* direct yield (see 'sol_yieldk') */
     }
   }
 }
@@ -805,11 +830,15 @@ static void resume (sol_State *L, void *ud) {
       ci->u.l.savedpc--;
       L->top.p = firstArg;  /* discard arguments */
       solV_execute(L, ci);  /* just continue running Sol code */
+      if (l_unlikely(L->status == SOL_YIELD))
+        return;  /* direct yield (see 'sol_yieldk') */
     }
     else {  /* 'common' yield */
       if (ci->u.c.k != NULL) {  /* does it have a continuation function? */
         sol_unlock(L);
+        L->nCcalls++;  /* continuations cannot yield directly */
         n = (*ci->u.c.k)(L, SOL_YIELD, ci->u.c.ctx); /* call continuation */
+        L->nCcalls--;
         sol_lock(L);
         api_checknelems(L, n);
       }
@@ -855,13 +884,14 @@ SOL_API int sol_resume (sol_State *L, sol_State *from, int nargs,
   if (getCcalls(L) >= SOLI_MAXCCALLS)
     return resume_error(L, "C stack overflow", nargs);
   L->nCcalls++;
+  L->nCresume = L->nCcalls;
   soli_userstateresume(L, nargs);
   api_checknelems(L, (L->status == SOL_OK) ? nargs + 1 : nargs);
   status = solD_rawrunprotected(L, resume, &nargs);
    /* continue running after recoverable errors */
   status = precover(L, status);
   if (l_likely(!errorstatus(status)))
-    sol_assert(status == L->status);  /* normal end or yield */
+    status = L->status;  /* normal end or yield (maybe a direct one) */
   else {  /* unrecoverable error */
     L->status = cast_byte(status);  /* mark thread as 'dead' */
     solD_seterrorobj(L, status, L->top.p);  /* push error message */
@@ -902,6 +932,15 @@ SOL_API int sol_yieldk (sol_State *L, int nresults, sol_KContext ctx,
   else {
     if ((ci->u.c.k = k) != NULL)  /* is there a continuation? */
       ci->u.c.ctx = ctx;  /* save context */
+    else if (L->nCcalls == L->nCresume && !(ci->callstatus & CIST_HOOKED)) {
+      /* direct yield: the function was called by 'resume' itself or by a
+         Sol function running in its 'solV_execute', so there is no
+         C frame to skip; the function returns and 'precallC' and
+         'solV_execute' return up to 'resume', leaving everything as a
+         long jump would */
+      sol_unlock(L);
+      return 0;
+    }
     solD_throw(L, SOL_YIELD);
   }
   sol_assert(ci->callstatus & CIST_HOOKED);  /* must be inside a hook */
@@ -967,7 +1006,8 @@ int solD_pcall (sol_State *L, Pfunc func, void *u,
     L->allowhook = old_allowhooks;
     status = solD_closeprotected(L, old_top, status);
     solD_seterrorobj(L, status, restorestack(L, old_top));
-    solD_shrinkstack(L);   /* restore stack size in case of overflow */
+    if (stacksize(L) > SOLI_MAXSTACK)  /* was handling an overflow? */
+      solD_shrinkstack(L);  /* restore stack size */
   }
   L->errfunc = old_errfunc;
   return status;
@@ -1001,8 +1041,16 @@ static void f_parser (sol_State *L, void *ud) {
   struct SParser *p = cast(struct SParser *, ud);
   int c = zgetc(p->z);  /* read first character */
   if (c == SOL_SIGNATURE[0]) {
-    checkmode(L, p->mode, "binary");
-    cl = solU_undump(L, p->z, p->name);
+    int fixed = 0;
+    if (p->mode != NULL && strchr(p->mode, 'B') != NULL)
+      fixed = 1;  /* binary chunk in a fixed buffer */
+    else
+      checkmode(L, p->mode, "binary");
+    cl = solU_undump(L, p->z, p->name, fixed);
+  }
+  else if (p->mode != NULL && strchr(p->mode, 'd') != NULL) {
+    solY_data(L, p->z, &p->buff, p->name, c);  /* data chunk */
+    return;  /* its value is not a function */
   }
   else {
     checkmode(L, p->mode, "text");
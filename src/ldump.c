@@ -15,8 +15,11 @@
 
 #include "sol.h"
 
+#include "ldo.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "ltable.h"
 #include "lundump.h"
 
 
@@ -25,6 +28,13 @@ typedef struct {
   sol_Writer writer;
   void *data;
   int strip;
+  int aligned;  /* aligned format? */
+  size_t offset;  /* bytes written so far */
+  Table *h;  /* saved strings -> their indices */
+  int nstr;  /* number of saved strings */
+  Table *anchor;  /* string tables in use, indexed by nesting level */
+  Table *sizes;  /* cached sizes of nested functions (aligned format) */
+  int level;  /* current nesting level of string tables */
   int status;
 } DumpState;
 
@@ -43,6 +53,7 @@ static void dumpBlock (DumpState *D, const void *b, size_t size) {
     sol_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     sol_lock(D->L);
+    D->offset += size;
   }
 }
 
@@ -89,20 +100,76 @@ static void dumpInteger (DumpState *D, sol_Integer x) {
 }
 
 
+/*
+** Dump a nullable string: 0 for NULL, 1 followed by its index for
+** a string already saved, or its size plus 2 followed by its contents.
+*/
 static void dumpString (DumpState *D, const TString *s) {
   if (s == NULL)
     dumpSize(D, 0);
   else {
-    size_t size = tsslen(s);
-    const char *str = getstr(s);
-    dumpSize(D, size + 1);
-    dumpVector(D, str, size);
+    TString *ts = cast(TString *, s);
+    const TValue *idx = solH_getstr(D->h, ts);
+    if (ttisinteger(idx)) {  /* string already saved? */
+      dumpSize(D, 1);
+      dumpInt(D, cast_int(ivalue(idx)));
+    }
+    else {  /* save the string and its index */
+      TValue key, value;
+      size_t size = tsslen(s);
+      dumpSize(D, size + 2);
+      dumpVector(D, getstr(s), size);
+      setsvalue(D->L, &key, ts);
+      setivalue(&value, ++D->nstr);
+      solH_set(D->L, D->h, &key, &value);  /* h[ts] = nstr */
+    }
   }
 }
 
 
+/*
+** Start a new (empty) string table, anchored in 'D->anchor'. The
+** previous table must be restored with 'endstrings'.
+*/
+static void newstrings (DumpState *D) {
+  sol_State *L = D->L;
+  TValue v;
+  D->h = solH_new(L);
+  D->nstr = 0;
+  sethvalue(L, &v, D->h);
+  solH_setint(L, D->anchor, ++D->level, &v);
+  solC_barrierback(L, obj2gco(D->anchor), &v);
+}
+
+
+static void endstrings (DumpState *D, Table *h, int nstr) {
+  D->level--;
+  D->h = h;
+  D->nstr = nstr;
+}
+
+
+/* maximum alignment used by 'dumpAlign' */
+#define MAXALIGN	8
+
+
+/*
+** In the aligned format, writes the number of padding bytes followed
+** by that many zeros, so that the next byte is at a multiple of 'align'.
+*/
+static void dumpAlign (DumpState *D, size_t align) {
+  static const char zeros[MAXALIGN] = {0};
+  int pad = cast_int((align - (D->offset + 1) % align) % align);
+  sol_assert(align <= sizeof(zeros));
+  dumpByte(D, pad);
+  dumpBlock(D, zeros, pad);
+}
+
+
 static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
+  if (D->aligned)
+    dumpAlign(D, sizeof(Instruction));
   dumpVector(D, f->code, f->sizecode);
 }
 
@@ -135,12 +202,67 @@ static void dumpConstants (DumpState *D, const Proto *f) {
 }
 
 
+static int countbytes (sol_State *L, const void *b, size_t size, void *ud) {
+  UNUSED(L); UNUSED(b); UNUSED(size); UNUSED(ud);
+  return 0;
+}
+
+
+/*
+** Size of the dump of function 'f' if it starts at offset 'offset'.
+** Padding depends on the offset modulo MAXALIGN, so each size is cached
+** in 'D->sizes' together with that residue (as 'size * MAXALIGN +
+** residue'). The count of a function does not go through its nested
+** functions again (see 'dumpProtos'), and the real dump finds all their
+** sizes already computed, so each function is counted only once.
+*/
+static size_t functionsize (DumpState *D, const Proto *f, TString *psource,
+                            size_t offset) {
+  size_t res = offset % MAXALIGN;
+  TValue key, value;
+  const TValue *o;
+  setpvalue(&key, cast_voidp(f));
+  o = solH_get(D->sizes, &key);
+  if (ttisinteger(o) && l_castS2U(ivalue(o)) % MAXALIGN == res)
+    return l_castS2U(ivalue(o)) / MAXALIGN;  /* cached */
+  else {
+    DumpState C = *D;
+    size_t size;
+    C.writer = countbytes;
+    C.offset = offset;
+    newstrings(&C);
+    dumpFunction(&C, f, psource);
+    endstrings(&C, NULL, 0);
+    size = C.offset - offset;
+    setivalue(&value, l_castU2S(size * MAXALIGN + res));
+    solH_set(D->L, D->sizes, &key, &value);
+    return size;
+  }
+}
+
+
 static void dumpProtos (DumpState *D, const Proto *f) {
   int i;
   int n = f->sizep;
   dumpInt(D, n);
-  for (i = 0; i < n; i++)
-    dumpFunction(D, f->p[i], f->source);
+  for (i = 0; i < n; i++) {
+    if (D->aligned) {  /* precede each function by its size */
+      Table *h = D->h;
+      int nstr = D->nstr;
+      size_t size = functionsize(D, f->p[i], f->source,
+                                 D->offset + sizeof(size_t));
+      dumpVar(D, size);
+      if (D->writer == countbytes)  /* only counting? */
+        D->offset += size;  /* skip it; it was already counted */
+      else {
+        newstrings(D);  /* each function has its own strings */
+        dumpFunction(D, f->p[i], f->source);
+        endstrings(D, h, nstr);
+      }
+    }
+    else
+      dumpFunction(D, f->p[i], f->source);
+  }
 }
 
 
@@ -162,9 +284,15 @@ static void dumpDebug (DumpState *D, const Proto *f) {
   dumpVector(D, f->lineinfo, n);
   n = (D->strip) ? 0 : f->sizeabslineinfo;
   dumpInt(D, n);
-  for (i = 0; i < n; i++) {
-    dumpInt(D, f->abslineinfo[i].pc);
-    dumpInt(D, f->abslineinfo[i].line);
+  if (D->aligned) {
+    dumpAlign(D, sizeof(AbsLineInfo));
+    dumpVector(D, f->abslineinfo, n);
+  }
+  else {
+    for (i = 0; i < n; i++) {
+      dumpInt(D, f->abslineinfo[i].pc);
+      dumpInt(D, f->abslineinfo[i].line);
+    }
   }
   n = (D->strip) ? 0 : f->sizelocvars;
   dumpInt(D, n);
@@ -181,6 +309,8 @@ static void dumpDebug (DumpState *D, const Proto *f) {
 
 
 static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
+  if (f->lazy != NULL)  /* body not loaded yet? */
+    solU_loadlazy(D->L, cast(Proto *, f));
   if (D->strip || f->source == psource)
     dumpString(D, NULL);  /* no debug info or same source as its parent */
   else
@@ -201,30 +331,80 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
 static void dumpHeader (DumpState *D) {
   dumpLiteral(D, SOL_SIGNATURE);
   dumpByte(D, SOLC_VERSION);
-  dumpByte(D, SOLC_FORMAT);
+  dumpByte(D, (D->aligned ? SOLC_FORMATALIGNED : SOLC_FORMAT) |
+              SOLC_FORMATSTRINGS);
   dumpLiteral(D, SOLC_DATA);
   dumpByte(D, sizeof(Instruction));
   dumpByte(D, sizeof(sol_Integer));
   dumpByte(D, sizeof(sol_Number));
+  if (D->aligned) {
+    dumpByte(D, sizeof(AbsLineInfo));
+    dumpByte(D, sizeof(size_t));
+  }
   dumpInteger(D, SOLC_INT);
   dumpNumber(D, SOLC_NUM);
 }
 
 
+typedef struct SDump {
+  DumpState *D;
+  const Proto *f;
+} SDump;
+
+
+static void f_dump (sol_State *L, void *ud) {
+  SDump *sd = cast(SDump *, ud);
+  DumpState *D = sd->D;
+  dumpHeader(D);
+  dumpByte(D, sd->f->sizeupvalues);
+  if (D->aligned) {  /* create (and anchor) the table of sizes */
+    TValue v;
+    D->sizes = solH_new(L);
+    sethvalue(L, &v, D->sizes);
+    solH_setint(L, D->anchor, 0, &v);
+    solC_barrierback(L, obj2gco(D->anchor), &v);
+  }
+  newstrings(D);
+  dumpFunction(D, sd->f, NULL);
+}
+
+
 /*
-** dump Sol function as precompiled chunk
+** dump Sol function as precompiled chunk, in the aligned format if
+** 'aligned' is true. The string tables are anchored in the registry,
+** as the writer may push values that must stay in the stack; the dump
+** runs protected so that the anchor is always removed.
 */
 int solU_dump(sol_State *L, const Proto *f, sol_Writer w, void *data,
-              int strip) {
+              int strip, int aligned) {
   DumpState D;
+  SDump sd;
+  Table *reg = hvalue(&G(L)->l_registry);
+  TValue key, value;
+  int status;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
+  D.aligned = aligned;
+  D.offset = 0;
   D.status = 0;
-  dumpHeader(&D);
-  dumpByte(&D, f->sizeupvalues);
-  dumpFunction(&D, f, NULL);
+  D.anchor = solH_new(L);
+  D.sizes = NULL;
+  D.level = 0;
+  sethvalue2s(L, L->top.p, D.anchor);  /* anchor it while it is inserted */
+  solD_inctop(L);
+  setpvalue(&key, &D);
+  sethvalue(L, &value, D.anchor);
+  solH_set(L, reg, &key, &value);  /* registry[&D] = anchor */
+  solC_barrierback(L, obj2gco(reg), &value);
+  L->top.p--;
+  sd.D = &D;
+  sd.f = f;
+  status = solD_rawrunprotected(L, f_dump, &sd);
+  setnilvalue(&value);
+  solH_set(L, reg, &key, &value);  /* remove anchor (key already present) */
+  if (l_unlikely(status != SOL_OK))
+    solD_throw(L, status);
   return D.status;
 }
-
@@ -80,22 +80,34 @@ static UpVal *newupval (sol_State *L, StkId level, UpVal **prev) {
 }
 
 
+/*
+** Entry of 'L->upvalcache' for the given stack level. Entries are
+** cleared when their upvalues are closed; open upvalues of a live
+** thread are never collected, so a non-NULL entry is always valid.
+*/
+#define upvalentry(L,level)  \
+	(&(L)->upvalcache[cast_int((level) - (L)->stack.p) & (SOLI_UPVALCACHE - 1)])
+
+
 /*
 ** Find and reuse, or create if it does not exist, an upvalue
 ** at the given level.
 */
 UpVal *solF_findupval (sol_State *L, StkId level) {
+  UpVal **entry = upvalentry(L, level);
   UpVal **pp = &L->openupval;
-  UpVal *p;
+  UpVal *p = *entry;
   sol_assert(isintwups(L) || L->openupval == NULL);
+  if (p != NULL && uplevel(p) == level)  /* cached? */
+    return p;
   while ((p = *pp) != NULL && uplevel(p) >= level) {  /* search for it */
     sol_assert(!isdead(G(L), p));
     if (uplevel(p) == level)  /* corresponding upvalue? */
-      return p;  /* return it */
+      return *entry = p;  /* return it */
     pp = &p->u.open.next;
   }
   /* not found: create a new upvalue after 'pp' */
-  return newupval(L, level, pp);
+  return *entry = newupval(L, level, pp);
 }
 
 
@@ -195,7 +207,10 @@ void solF_closeupval (sol_State *L, StkId level) {
   StkId upl;  /* stack index pointed by 'uv' */
   while ((uv = L->openupval) != NULL && (upl = uplevel(uv)) >= level) {
     TValue *slot = &uv->u.value;  /* new position for value */
+    UpVal **entry = upvalentry(L, upl);
     sol_assert(uplevel(uv) < L->top.p);
+    if (*entry == uv)
+      *entry = NULL;
     solF_unlinkupval(uv);  /* remove upvalue from 'openupval' list */
     setobj(L, slot, uv->v.p);  /* move value to upvalue slot */
     uv->v.p = slot;  /* now current value lives here */
@@ -255,21 +270,26 @@ Proto *solF_newproto (sol_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+  f->flag = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->lazy = NULL;
+  f->cache = NULL;
   return f;
 }
 
 
 void solF_freeproto (sol_State *L, Proto *f) {
-  solM_freearray(L, f->code, f->sizecode);
+  if (!isfixed(f)) {  /* vectors are not in an external buffer? */
+    solM_freearray(L, f->code, f->sizecode);
+    solM_freearray(L, f->lineinfo, f->sizelineinfo);
+    solM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
+  }
   solM_freearray(L, f->p, f->sizep);
   solM_freearray(L, f->k, f->sizek);
-  solM_freearray(L, f->lineinfo, f->sizelineinfo);
-  solM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   solM_freearray(L, f->locvars, f->sizelocvars);
   solM_freearray(L, f->upvalues, f->sizeupvalues);
   solM_free(L, f);
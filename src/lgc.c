@@ -11,6 +11,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 
 #include "sol.h"
@@ -60,6 +61,24 @@
 #define PAUSEADJ		100
 
 
+/*
+** Memory is given back to the system after a major collection only when
+** the heap shrank to less than half its peak, and by at least this many
+** bytes.
+*/
+#define RELEASEMIN	(cast(lu_mem, 1) << 20)
+
+
+/*
+** Clock used to time collector phases and pauses. ('clock' measures
+** processor time, which is what the collector consumes; a port may
+** define a cheaper or more precise source.)
+*/
+#if !defined(soli_gcclock)
+#define soli_gcclock()		((double)clock() / CLOCKS_PER_SEC)
+#endif
+
+
 /* mask with all color bits */
 #define maskcolors	(bitmask(BLACKBIT) | WHITEBITS)
 
@@ -109,6 +128,124 @@ static lu_mem atomic (sol_State *L);
 static void entersweep (sol_State *L);
 
 
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+
+/*
+** Phase (as reported in 'sol_GCStats') of each collector state
+*/
+static const lu_byte statephase[] = {
+  SOL_GCPPROPAGATE,  /* GCSpropagate */
+  SOL_GCPATOMIC,  /* GCSenteratomic */
+  SOL_GCPATOMIC,  /* GCSatomic */
+  SOL_GCPSWEEP,  /* GCSswpallgc */
+  SOL_GCPSWEEP,  /* GCSswpfinobj */
+  SOL_GCPSWEEP,  /* GCSswptobefnz */
+  SOL_GCPSWEEP,  /* GCSswpend */
+  SOL_GCPCALLFIN,  /* GCScallfin */
+  SOL_GCPPROPAGATE  /* GCSpause */
+};
+
+
+/*
+** Charge the time elapsed since the last accounting point to the
+** phase of collector state 'state'. Called only on state transitions
+** and at the end of pauses, so that the clock is read a few times per
+** cycle and not once per object.
+*/
+static void chargephase (global_State *g, int state) {
+  double now = soli_gcclock();
+  g->gcstats.phasetime[statephase[state]] += now - g->gcclock;
+  g->gcclock = now;
+}
+
+
+/*
+** Start a collector pause (a period in which the collector holds the
+** mutator). Returns the time it started.
+*/
+static double startpause (global_State *g) {
+  g->gcclock = soli_gcclock();
+  return g->gcclock;
+}
+
+
+/*
+** Finish a pause that started at 'start': charge the current phase and
+** add the pause to the histogram, where bin 'i' counts pauses shorter
+** than 2^i microseconds (the last bin gets all longer ones).
+*/
+static void endpause (global_State *g, double start) {
+  sol_GCStats *st = &g->gcstats;
+  double d;
+  double limit = 1e-6;
+  int bin = 0;
+  chargephase(g, g->gcstate);
+  d = g->gcclock - start;
+  while (d >= limit && bin < SOL_GCPAUSEBINS - 1) {
+    limit *= 2;
+    bin++;
+  }
+  st->pausehist[bin]++;
+  st->npauses++;
+  st->pausetime += d;
+  if (d > st->maxpause)
+    st->maxpause = d;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Returning memory to the system
+** =======================================================
+*/
+
+#define notepeak(g)  \
+	{ if (gettotalbytes(g) > (g)->gcpeak) (g)->gcpeak = gettotalbytes(g); }
+
+
+static int callrelease (global_State *g) {
+  lu_mem inuse = gettotalbytes(g);
+  int res = (*g->releasef)(g->ud_release, inuse);
+  g->gcstats.nreleases++;
+  g->gcpeak = inuse;  /* start tracking a new peak */
+  return res;
+}
+
+
+/*
+** Called at the end of each major collection: when the heap is much
+** smaller than it was at its peak, the allocator probably keeps many
+** free pages that the program may never need again.
+*/
+static void checkrelease (global_State *g) {
+  lu_mem inuse = gettotalbytes(g);
+  if (g->releasef != NULL && g->gcpeak / 2 > inuse &&
+                             g->gcpeak - inuse >= RELEASEMIN)
+    callrelease(g);
+}
+
+
+/*
+** Give memory back to the system regardless of the heap size. Returns
+** the result of the release function (0 if there is none).
+*/
+int solC_release (sol_State *L) {
+  global_State *g = G(L);
+  return (g->releasef != NULL) ? callrelease(g) : 0;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** Generic functions
@@ -223,15 +360,50 @@ void solC_barrier_ (sol_State *L, GCObject *o, GCObject *v) {
 }
 
 
+/*
+** Back barrier for a table with a card table, in generational mode.
+** The table stays black, so that every store of a young object into it
+** reaches this barrier and marks its card, and it is linked into
+** 'grayagain' as any touched object; the young collection retraverses
+** only its dirty cards. That is enough only for tables that were
+** regular old: other old tables may refer to young objects from any
+** slot, so all their cards become dirty.
+*/
+static void touchcards (global_State *g, Table *t) {
+  switch (getage(t)) {
+    case G_TOUCHED1: case G_TOUCHED2:
+      break;  /* already in 'grayagain' */
+    case G_OLD:
+      linkgclist(t, g->grayagain);
+      nw2black(t);  /* keep it black */
+      break;
+    default:
+      memset(getcards(t), CARD_TOUCHED1, solH_numcards(t));
+      linkgclist(t, g->grayagain);
+      nw2black(t);  /* keep it black */
+      break;
+  }
+  setage(t, G_TOUCHED1);
+}
+
+
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. (A black TOUCHED1 object is
+** a table that has lost its card table; it is already in 'grayagain'.)
 */
 void solC_barrierback_ (sol_State *L, GCObject *o) {
   global_State *g = G(L);
   sol_assert(isblack(o) && !isdead(g, o));
-  sol_assert((g->gckind == KGC_GEN) == (isold(o) && getage(o) != G_TOUCHED1));
-  if (getage(o) == G_TOUCHED2)  /* already in gray list? */
+  sol_assert((g->gckind == KGC_GEN) == isold(o));
+  if (o->tt == SOL_VTABLE && hascards(gco2t(o)) &&
+      g->gckind == KGC_GEN) {  /* unknown slot of a large table? */
+    Table *t = gco2t(o);
+    memset(getcards(t), CARD_TOUCHED1, solH_numcards(t));
+    touchcards(g, t);
+    return;
+  }
+  if (getage(o) == G_TOUCHED2 || getage(o) == G_TOUCHED1)  /* in a list? */
     set2gray(o);  /* make it gray to become touched1 */
   else  /* link it in 'grayagain' and paint it gray */
     linkobjgclist(o, g->grayagain);
@@ -240,6 +412,22 @@ void solC_barrierback_ (sol_State *L, GCObject *o) {
 }
 
 
+/*
+** Back barrier for a store into a known slot of table 't': large tables
+** in generational mode only mark the card of that slot.
+*/
+void solC_barriercard_ (sol_State *L, Table *t, const TValue *slot) {
+  global_State *g = G(L);
+  if (hascards(t) && g->gckind == KGC_GEN) {
+    sol_assert(isblack(t) && isold(t) && !isdead(g, obj2gco(t)));
+    getcards(t)[solH_cardof(t, slot)] = CARD_TOUCHED1;
+    touchcards(g, t);
+  }
+  else
+    solC_barrierback_(L, obj2gco(t));
+}
+
+
 void solC_fix (sol_State *L, GCObject *o) {
   global_State *g = G(L);
   sol_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
@@ -520,22 +708,64 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 }
 
 
+static void marknode (global_State *g, Node *n) {
+  if (isempty(gval(n)))  /* entry is empty? */
+    clearkey(n);  /* clear its key */
+  else {
+    sol_assert(!keyisnil(n));
+    markkey(g, n);
+    markvalue(g, gval(n));
+  }
+}
+
+
 static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   unsigned int i;
   unsigned int asize = solH_realasize(h);
   for (i = 0; i < asize; i++)  /* traverse array part */
     markvalue(g, &h->array[i]);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else {
-      sol_assert(!keyisnil(n));
-      markkey(g, n);
-      markvalue(g, gval(n));
+  for (n = gnode(h, 0); n < limit; n++)  /* traverse hash part */
+    marknode(g, n);
+  if (hascards(h))  /* all slots seen; no card is dirty now */
+    memset(getcards(h), CARD_CLEAN, solH_numcards(h));
+  genlink(g, obj2gco(h));
+}
+
+
+/*
+** Traverse the dirty cards of a touched table with a card table, in a
+** young collection, aging them. (Its other slots only refer to old
+** objects.) Returns the number of slots traversed.
+*/
+static lu_mem traversecards (global_State *g, Table *h) {
+  unsigned int nsize = sizenode(h);
+  unsigned int asize = solH_realasize(h);
+  unsigned int nodecards = numcards(nsize);
+  unsigned int ncards = nodecards + numcards(asize);
+  lu_byte *cards = getcards(h);
+  unsigned int c, i;
+  lu_mem work = 0;
+  for (c = 0; c < ncards; c++) {
+    if (cards[c] != CARD_CLEAN) {
+      cards[c]--;  /* TOUCHED1 -> TOUCHED2 -> CLEAN */
+      if (c < nodecards) {
+        unsigned int last = (c + 1) * CARDSIZE;
+        if (last > nsize) last = nsize;
+        for (i = c * CARDSIZE; i < last; i++)
+          marknode(g, gnode(h, i));
+      }
+      else {
+        unsigned int last = (c - nodecards + 1) * CARDSIZE;
+        if (last > asize) last = asize;
+        for (i = (c - nodecards) * CARDSIZE; i < last; i++)
+          markvalue(g, &h->array[i]);
+      }
+      work += CARDSIZE;
     }
   }
   genlink(g, obj2gco(h));
+  return work;
 }
 
 
@@ -556,6 +786,9 @@ static lu_mem traversetable (global_State *g, Table *h) {
     else  /* all weak */
       linkgclist(h, g->allweak);  /* nothing to traverse now */
   }
+  else if (hascards(h) && g->gckind == KGC_GEN &&
+           (getage(h) == G_TOUCHED1 || getage(h) == G_TOUCHED2))
+    return 1 + traversecards(g, h);  /* only its dirty cards */
   else  /* not weak */
     traversestrongtable(g, h);
   return 1 + h->alimit + 2 * allocsizenode(h);
@@ -577,8 +810,16 @@ static int traverseudata (global_State *g, Udata *u) {
 ** arrays can be larger than needed; the extra slots are filled with
 ** NULL, so the use of 'markobjectN')
 */
+/*
+** The closure cache of a prototype is a weak reference: it is cleared
+** if the closure is not marked yet. (A closure cached after this
+** traversal went through a back barrier, so the prototype is traversed
+** again; 'genlink' keeps it in 'grayagain' while that closure is young.)
+*/
 static int traverseproto (global_State *g, Proto *f) {
   int i;
+  if (f->cache && iswhite(f->cache))
+    f->cache = NULL;  /* allow cache to be collected */
   markobjectN(g, f->source);
   for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
@@ -588,6 +829,7 @@ static int traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
+  genlink(g, obj2gco(f));
   return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
 }
 
@@ -770,6 +1012,9 @@ static void freeupval (sol_State *L, UpVal *uv) {
 
 
 static void freeobj (sol_State *L, GCObject *o) {
+  global_State *g = G(L);
+  l_mem olddebt = g->GCdebt;
+  g->gcstats.nfreed[novariant(o->tt)]++;
   switch (o->tt) {
     case SOL_VPROTO:
       solF_freeproto(L, gco2p(o));
@@ -811,6 +1056,7 @@ static void freeobj (sol_State *L, GCObject *o) {
     }
     default: sol_assert(0);
   }
+  g->gcstats.bytesswept += cast(size_t, olddebt - g->GCdebt);
 }
 
 
@@ -887,6 +1133,7 @@ static GCObject *udata2finalize (global_State *g) {
   GCObject *o = g->tobefnz;  /* get first element */
   sol_assert(tofinalize(o));
   g->tobefnz = o->next;  /* remove it from 'tobefnz' list */
+  g->gcstats.pendingfin--;
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
@@ -954,6 +1201,16 @@ static void callallpendingfinalizers (sol_State *L) {
 }
 
 
+/*
+** Run up to 'n' pending finalizers ('n' <= 0 means all of them);
+** this is how finalizers run when the collector defers them to
+** points chosen by the program ('gcdeferfin').
+*/
+int solC_runfinalizers (sol_State *L, int n) {
+  return runafewfinalizers(L, (n > 0) ? n : MAX_INT);
+}
+
+
 /*
 ** find last 'next' field in list 'p' list (to add elements in its end)
 */
@@ -986,6 +1243,7 @@ static void separatetobefnz (global_State *g, int all) {
       curr->next = *lastnext;  /* link at the end of 'tobefnz' list */
       *lastnext = curr;
       lastnext = &curr->next;
+      g->gcstats.pendingfin++;
     }
   }
 }
@@ -1237,9 +1495,14 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 static void finishgencycle (sol_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
+  chargephase(g, GCSswpend);
+  g->gcstats.bytesmarked += gettotalbytes(g);
   g->gcstate = GCSpropagate;  /* skip restart */
-  if (!g->gcemergency)
-    callallpendingfinalizers(L);
+  if (!g->gcemergency) {
+    if (!g->gcdeferfin)
+      callallpendingfinalizers(L);
+    chargephase(g, GCScallfin);
+  }
 }
 
 
@@ -1258,7 +1521,10 @@ static void youngcollection (sol_State *L, global_State *g) {
   }
   markold(g, g->finobj, g->finobjrold);
   markold(g, g->tobefnz, NULL);
+  chargephase(g, GCSpropagate);
   atomic(L);
+  chargephase(g, GCSatomic);
+  g->gcstats.nminor++;
 
   /* sweep nursery and get a pointer to its last live element */
   g->gcstate = GCSswpallgc;
@@ -1308,6 +1574,7 @@ static void atomic2gen (sol_State *L, global_State *g) {
   g->lastatomic = 0;
   g->GCestimate = gettotalbytes(g);  /* base for memory control */
   finishgencycle(L, g);
+  checkrelease(g);
 }
 
 
@@ -1331,6 +1598,8 @@ static lu_mem entergen (sol_State *L, global_State *g) {
   solC_runtilstate(L, bitmask(GCSpause));  /* prepare to start a new cycle */
   solC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
   numobjs = atomic(L);  /* propagates all and then do the atomic stuff */
+  chargephase(g, GCSatomic);
+  g->gcstats.nmajor++;
   atomic2gen(L, g);
   setminordebt(g);  /* set debt assuming next cycle will be minor */
   return numobjs;
@@ -1360,10 +1629,12 @@ static void enterinc (global_State *g) {
 void solC_changemode (sol_State *L, int newmode) {
   global_State *g = G(L);
   if (newmode != g->gckind) {
+    double start = startpause(g);
     if (newmode == KGC_GEN)  /* entering generational mode? */
       entergen(L, g);
     else
       enterinc(g);  /* entering incremental mode */
+    endpause(g, start);
   }
   g->lastatomic = 0;
 }
@@ -1406,6 +1677,8 @@ static void stepgenfull (sol_State *L, global_State *g) {
     enterinc(g);  /* enter incremental mode */
   solC_runtilstate(L, bitmask(GCSpropagate));  /* start new cycle */
   newatomic = atomic(L);  /* mark everybody */
+  chargephase(g, GCSatomic);
+  g->gcstats.nmajor++;
   if (newatomic < lastatomic + (lastatomic >> 3)) {  /* good collection? */
     atomic2gen(L, g);  /* return to generational mode */
     setminordebt(g);
@@ -1469,6 +1742,125 @@ static void genstep (sol_State *L, global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Adaptive mode
+** =======================================================
+*/
+
+/* average survival (in percentage) below/above which modes change */
+#define ADAPTTOGEN	10
+#define ADAPTTOINC	40
+
+/* limits for the number of collections between two decisions */
+#define ADAPTMINWINDOW	4
+#define ADAPTMAXWINDOW	64
+
+
+/*
+** Turn the adaptive mode on or off. Measures start from scratch, from
+** the current mode.
+*/
+void solC_setadaptive (sol_State *L, int on) {
+  global_State *g = G(L);
+  GCAdapt *a = &g->adapt;
+  g->gcadapt = cast_byte(on);
+  a->cost[KGC_INC] = a->cost[KGC_GEN] = 0;
+  a->wtime = g->gcstats.pausetime;
+  a->walloc = 0;
+  a->live = gettotalbytes(g);
+  a->swept = g->gcstats.bytesswept;
+  a->survival = (ADAPTTOGEN + ADAPTTOINC) / 2;
+  a->ncycles = 0;
+  a->window = ADAPTMINWINDOW;
+}
+
+
+static void adaptwarn (sol_State *L, int newmode, int survival) {
+  global_State *g = G(L);
+  lu_byte oldstp = g->gcstp;
+  char buff[100];
+  size_t len;
+  l_sprintf(buff, sizeof(buff), "collector switching to %s mode",
+            (newmode == KGC_GEN) ? "generational" : "incremental");
+  len = strlen(buff);
+  l_sprintf(buff + len, sizeof(buff) - len,
+            " (%d%% of allocation survives)", survival);
+  g->gcstp |= GCSTPGC;  /* avoid GC steps */
+  solE_warning(L, buff, 0);
+  g->gcstp = oldstp;
+}
+
+
+/*
+** Called at the end of each automatic collection in adaptive mode.
+** Each collection gives a sample of the percentage of the bytes
+** allocated since the previous one that are still in use: after a
+** minor collection, that is how much of the young generation survived;
+** after an incremental cycle, it is how much the heap grew, which
+** approximates it; a bad major collection counts as full survival. At
+** the end of each window of collections, the collector switches to the
+** generational mode if little survives, or back to the incremental
+** mode if much does, unless the cost measured for the other mode (GC
+** time per Kbyte allocated) was not lower than the current one. Each
+** switch doubles the window and each window without a switch shrinks
+** it and ages the cost of the other mode, so that modes do not
+** oscillate but old measures do not last forever.
+*/
+static void adaptmode (sol_State *L, global_State *g) {
+  GCAdapt *a = &g->adapt;
+  lu_mem total = gettotalbytes(g);
+  lu_mem freed = g->gcstats.bytesswept - a->swept;
+  int mode = isdecGCmodegen(g) ? KGC_GEN : KGC_INC;
+  int sample = 0;
+  if (total + freed > a->live) {  /* allocated anything? */
+    lu_mem alloc = total + freed - a->live;
+    if (total > a->live)
+      sample = cast_int(100.0 * cast_num(total - a->live) / cast_num(alloc));
+    a->walloc += alloc;
+  }
+  if (g->lastatomic != 0)  /* bad major collection? */
+    sample = 100;
+  a->survival = (3 * a->survival + sample) / 4;
+  if (++a->ncycles >= a->window) {  /* end of window? */
+    double cost = (g->gcstats.pausetime - a->wtime) /
+                  (cast_num(a->walloc) / 1024 + 1);
+    int newmode = mode;
+    a->cost[mode] = cost;
+    if (mode == KGC_INC && a->survival < ADAPTTOGEN)
+      newmode = KGC_GEN;
+    else if (mode == KGC_GEN && a->survival > ADAPTTOINC)
+      newmode = KGC_INC;
+    if (newmode != mode && a->cost[newmode] != 0 && a->cost[newmode] >= cost)
+      newmode = mode;  /* other mode was not cheaper */
+    if (newmode != mode) {
+      adaptwarn(L, newmode, a->survival);
+      if (newmode == KGC_GEN)
+        entergen(L, g);
+      else {
+        if (g->gckind == KGC_GEN)
+          enterinc(g);
+        g->lastatomic = 0;
+      }
+      if (a->window < ADAPTMAXWINDOW)
+        a->window *= 2;
+    }
+    else {
+      a->cost[!mode] *= 0.75;  /* age measure of the other mode */
+      if (a->window > ADAPTMINWINDOW)
+        a->window--;
+    }
+    a->ncycles = 0;
+    a->walloc = 0;
+    a->wtime = g->gcstats.pausetime;
+  }
+  a->live = gettotalbytes(g);
+  a->swept = g->gcstats.bytesswept;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** GC control
@@ -1585,6 +1977,7 @@ static int sweepstep (sol_State *L, global_State *g,
 static lu_mem singlestep (sol_State *L) {
   global_State *g = G(L);
   lu_mem work;
+  int oldstate = g->gcstate;
   sol_assert(!g->gcstopem);  /* collector is not reentrant */
   g->gcstopem = 1;  /* no emergency collections while collecting */
   switch (g->gcstate) {
@@ -1607,6 +2000,7 @@ static lu_mem singlestep (sol_State *L) {
       work = atomic(L);  /* work is what was traversed by 'atomic' */
       entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */
+      g->gcstats.nmajor++;
       break;
     }
     case GCSswpallgc: {  /* sweep "regular" objects */
@@ -1623,17 +2017,19 @@ static lu_mem singlestep (sol_State *L) {
     }
     case GCSswpend: {  /* finish sweeps */
       checkSizes(L, g);
+      g->gcstats.bytesmarked += g->GCestimate;
       g->gcstate = GCScallfin;
       work = 0;
       break;
     }
     case GCScallfin: {  /* call remaining finalizers */
-      if (g->tobefnz && !g->gcemergency) {
+      if (g->tobefnz && !g->gcemergency && !g->gcdeferfin) {
         g->gcstopem = 0;  /* ok collections during finalizers */
         work = runafewfinalizers(L, GCFINMAX) * GCFINALIZECOST;
       }
-      else {  /* emergency mode or no more finalizers */
+      else {  /* emergency mode, deferred or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        checkrelease(g);
         work = 0;
       }
       break;
@@ -1641,6 +2037,8 @@ static lu_mem singlestep (sol_State *L) {
     default: sol_assert(0); return 0;
   }
   g->gcstopem = 0;
+  if (g->gcstate != oldstate)  /* changed phase? */
+    chargephase(g, oldstate);
   return work;
 }
 
@@ -1674,8 +2072,11 @@ static void incstep (sol_State *L, global_State *g) {
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
   } while (debt > -stepsize && g->gcstate != GCSpause);
-  if (g->gcstate == GCSpause)
+  if (g->gcstate == GCSpause) {
     setpause(g);  /* pause until next cycle */
+    if (g->gcadapt)
+      adaptmode(L, g);
+  }
   else {
     debt = (debt / stepmul) * WORK2MEM;  /* convert 'work units' to bytes */
     solE_setdebt(g, debt);
@@ -1692,10 +2093,16 @@ void solC_step (sol_State *L) {
   if (!gcrunning(g))  /* not running? */
     solE_setdebt(g, -2000);
   else {
-    if(isdecGCmodegen(g))
+    double start = startpause(g);
+    notepeak(g);
+    if(isdecGCmodegen(g)) {
       genstep(L, g);
+      if (g->gcadapt)
+        adaptmode(L, g);
+    }
     else
       incstep(L, g);
+    endpause(g, start);
   }
 }
 
@@ -1729,13 +2136,20 @@ static void fullinc (sol_State *L, global_State *g) {
 */
 void solC_fullgc (sol_State *L, int isemergency) {
   global_State *g = G(L);
+  double start = startpause(g);
+  notepeak(g);
   sol_assert(!g->gcemergency);
   g->gcemergency = isemergency;  /* set flag */
+  if (isemergency) {
+    g->gcstats.nemergency++;
+    solE_clearthreadpool(L);  /* pooled threads are free memory */
+  }
   if (g->gckind == KGC_INC)
     fullinc(L, g);
   else
     fullgen(L, g);
   g->gcemergency = 0;
+  endpause(g, start);
 }
 
 /* }====================================================== */
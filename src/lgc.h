@@ -185,6 +185,11 @@
 #define solC_barrierback(L,p,v) (  \
 	iscollectable(v) ? solC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
 
+/* back barrier for a store of 'v' into slot 's' of table 't' */
+#define solC_barrierslot(L,t,s,v) (  \
+	(iscollectable(v) && isblack(t) && iswhite(gcvalue(v))) ? \
+	solC_barriercard_(L,t,s) : cast_void(0))
+
 SOLI_FUNC void solC_fix (sol_State *L, GCObject *o);
 SOLI_FUNC void solC_freeallobjects (sol_State *L);
 SOLI_FUNC void solC_step (sol_State *L);
@@ -195,8 +200,13 @@ SOLI_FUNC GCObject *solC_newobjdt (sol_State *L, int tt, size_t sz,
                                                  size_t offset);
 SOLI_FUNC void solC_barrier_ (sol_State *L, GCObject *o, GCObject *v);
 SOLI_FUNC void solC_barrierback_ (sol_State *L, GCObject *o);
+SOLI_FUNC void solC_barriercard_ (sol_State *L, Table *t,
+                                                const TValue *slot);
 SOLI_FUNC void solC_checkfinalizer (sol_State *L, GCObject *o, Table *mt);
 SOLI_FUNC void solC_changemode (sol_State *L, int newmode);
+SOLI_FUNC void solC_setadaptive (sol_State *L, int on);
+SOLI_FUNC int solC_release (sol_State *L);
+SOLI_FUNC int solC_runfinalizers (sol_State *L, int n);
 
 
 #endif
@@ -0,0 +1,797 @@
+/*
+** $Id: limage.c $
+** Images of loaded modules, for fast startup
+** See Copyright Notice in sol.h
+*/
+
+#define limage_c
+#define SOL_LIB
+
+#include "lprefix.h"
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+** This file uses only the official API of Sol.
+** Any function declared here could be written as an application function.
+**
+** An image holds the table of loaded modules (package.loaded) and
+** everything reachable from it: tables, strings, numbers and Sol
+** functions (as binary chunks, with their upvalues). C functions and
+** userdata cannot be saved; they are recorded by their paths in the
+** loaded libraries (e.g., 'string.format' or 'io.stdout') and relinked
+** to the first of those paths that exists when the image is loaded into
+** a new state, which must have opened the same C libraries. Tables
+** found through such a path (e.g., '_G' or 'string') are reused and
+** updated in place.
+*/
+
+#include "sol.h"
+
+#include "lauxlib.h"
+
+
+/* mark for images ('<esc>SolImage') */
+#define IMAGESIGNATURE	"\x1bSolImage"
+
+#define IMAGEFORMAT	1
+
+/* data to catch conversion errors */
+#define IMAGEINT	0x5678
+#define IMAGENUM	((sol_Number)370.5)
+
+
+/* tags for values in an image */
+#define IMG_NIL		0
+#define IMG_FALSE	1
+#define IMG_TRUE	2
+#define IMG_INT		3
+#define IMG_FLT		4
+#define IMG_STR		5	/* new string */
+#define IMG_REF		6	/* object already in the image */
+#define IMG_NAME	7	/* object found through its paths */
+#define IMG_TABLE	8	/* new table */
+#define IMG_LCL		9	/* new Sol function */
+#define IMG_UPREF	10	/* upvalue shared with an earlier function */
+
+
+/* longest path used to name library values */
+#define MAXPATH		3
+
+/* maximum number of paths kept for a library value */
+#define MAXPATHS	4
+
+/* limit for nested tables and functions */
+#if !defined(SOLI_MAXIMAGEDEPTH)
+#define SOLI_MAXIMAGEDEPTH	200
+#endif
+
+
+/* stack slots used while saving or loading */
+#define OBJS		1	/* object -> index (save); index -> object (load) */
+#define NAMES		2	/* object -> list of paths (save) */
+#define UPVALS		3	/* upvalue id -> function index * 256 + n (save) */
+
+
+/*
+** {======================================================
+** Saving
+** =======================================================
+*/
+
+typedef struct SaveState {
+  sol_State *L;
+  FILE *f;
+  int nobj;  /* number of objects in the image */
+  int depth;  /* nesting level */
+} SaveState;
+
+
+#define saveVar(S,x)	saveBlock(S, &(x), sizeof(x))
+
+static void saveBlock (SaveState *S, const void *b, size_t size) {
+  if (size > 0)
+    fwrite(b, 1, size, S->f);
+}
+
+
+static void saveByte (SaveState *S, int b) {
+  unsigned char x = (unsigned char)b;
+  saveVar(S, x);
+}
+
+
+static void saveInt (SaveState *S, int i) {
+  saveVar(S, i);
+}
+
+
+static int nameable (sol_State *L, int idx) {
+  switch (sol_type(L, idx)) {
+    case SOL_TTABLE: case SOL_TUSERDATA: return 1;
+    case SOL_TFUNCTION: return sol_iscfunction(L, idx);
+    default: return 0;
+  }
+}
+
+
+/*
+** Add the path 'parent' + key (key and value on the top) to the paths
+** of the value. Returns true if it is the first path of the value.
+*/
+static int namefield (sol_State *L, int parent) {
+  int n = (int)sol_rawlen(L, parent);
+  int k = sol_type(L, -2);
+  int npaths;
+  if (!(k == SOL_TSTRING || (k == SOL_TNUMBER && sol_isinteger(L, -2))) ||
+      !nameable(L, -1))
+    return 0;
+  sol_pushvalue(L, -1);
+  if (sol_rawget(L, NAMES) == SOL_TNIL) {  /* first path? */
+    sol_pop(L, 1);
+    sol_createtable(L, 1, 0);
+    sol_pushvalue(L, -2);
+    sol_pushvalue(L, -2);
+    sol_rawset(L, NAMES);  /* NAMES[value] = {} */
+  }
+  npaths = (int)sol_rawlen(L, -1);
+  if (npaths < MAXPATHS) {
+    int i;
+    sol_createtable(L, n + 1, 0);  /* new path */
+    for (i = 1; i <= n; i++) {
+      sol_rawgeti(L, parent, i);
+      sol_rawseti(L, -2, i);
+    }
+    sol_pushvalue(L, -4);  /* key */
+    sol_rawseti(L, -2, n + 1);
+    sol_rawseti(L, -2, npaths + 1);
+  }
+  sol_pop(L, 1);  /* list of paths */
+  return (npaths == 0);
+}
+
+
+/*
+** Name the fields of the table at the top (whose path is at 'path').
+** Tables named for the first time go to the queue 'q' (with 'n'
+** elements), if not too deep.
+*/
+static int namefields (sol_State *L, int path, int q, int n) {
+  int t = sol_gettop(L);
+  int depth = (int)sol_rawlen(L, path) + 1;
+  sol_pushnil(L);
+  while (sol_next(L, t)) {
+    if (namefield(L, path) && depth < MAXPATH &&
+        sol_type(L, -1) == SOL_TTABLE) {
+      sol_pushvalue(L, -1);
+      sol_rawseti(L, q, ++n);  /* enqueue it */
+    }
+    sol_pop(L, 1);
+  }
+  return n;
+}
+
+
+/*
+** Collect the paths from the loaded table to the C functions, userdata
+** and tables reachable from the loaded modules, in breadth-first order.
+*/
+static void namelibs (sol_State *L) {
+  int q, n, i;
+  sol_getfield(L, SOL_REGISTRYINDEX, SOL_LOADED_TABLE);
+  sol_pushvalue(L, -1);
+  sol_createtable(L, 1, 0);
+  sol_newtable(L);  /* the loaded table has an empty path */
+  sol_rawseti(L, -2, 1);
+  sol_rawset(L, NAMES);
+  sol_newtable(L);  /* queue */
+  q = sol_gettop(L);
+  sol_pushvalue(L, q - 1);
+  sol_rawseti(L, q, 1);
+  n = 1;
+  for (i = 1; i <= n; i++) {
+    sol_rawgeti(L, q, i);
+    sol_pushvalue(L, -1);
+    sol_rawget(L, NAMES);
+    sol_rawgeti(L, -1, 1);  /* first path of the table */
+    sol_pushvalue(L, q + 1);
+    n = namefields(L, q + 3, q, n);
+    sol_settop(L, q);
+  }
+  sol_pop(L, 2);  /* queue and loaded table */
+}
+
+
+static void saveValue (SaveState *S, int o);
+
+
+static void saveNumber (SaveState *S, int o) {
+  sol_State *L = S->L;
+  if (sol_isinteger(L, o)) {
+    sol_Integer i = sol_tointeger(L, o);
+    saveByte(S, IMG_INT);
+    saveVar(S, i);
+  }
+  else {
+    sol_Number x = sol_tonumber(L, o);
+    saveByte(S, IMG_FLT);
+    saveVar(S, x);
+  }
+}
+
+
+static void saveString (SaveState *S, int o) {
+  size_t size;
+  const char *s = sol_tolstring(S->L, o, &size);
+  saveByte(S, IMG_STR);
+  saveVar(S, size);
+  saveBlock(S, s, size);
+}
+
+
+/*
+** Save the sizes (to presize it when loading), the metatable and the
+** contents of table 'o'.
+*/
+static void saveTable (SaveState *S, int o) {
+  sol_State *L = S->L;
+  sol_Unsigned len = sol_rawlen(L, o);
+  int narr = 0, nrec = 0;
+  sol_pushnil(L);
+  while (sol_next(L, o)) {
+    if (sol_isinteger(L, -2) &&
+        (sol_Unsigned)sol_tointeger(L, -2) - 1u < len)
+      narr++;
+    else
+      nrec++;
+    sol_pop(L, 1);
+  }
+  saveInt(S, narr);
+  saveInt(S, nrec);
+  if (sol_getmetatable(L, o)) {
+    saveValue(S, sol_gettop(L));
+    sol_pop(L, 1);
+  }
+  else
+    saveByte(S, IMG_NIL);
+  sol_pushnil(L);
+  while (sol_next(L, o)) {
+    int top = sol_gettop(L);
+    saveValue(S, top - 1);
+    saveValue(S, top);
+    sol_pop(L, 1);
+  }
+  saveByte(S, IMG_NIL);  /* end of contents */
+}
+
+
+struct Writer {
+  int init;  /* true iff buffer has been initialized */
+  solL_Buffer B;
+};
+
+
+static int writer (sol_State *L, const void *b, size_t size, void *ud) {
+  struct Writer *state = (struct Writer *)ud;
+  if (!state->init) {
+    state->init = 1;
+    solL_buffinit(L, &state->B);
+  }
+  solL_addlstring(&state->B, (const char *)b, size);
+  return 0;
+}
+
+
+/* save Sol function 'o', which is object 'index' */
+static void saveFunction (SaveState *S, int o, int index) {
+  sol_State *L = S->L;
+  struct Writer state;
+  size_t size;
+  const char *chunk;
+  int n, nup;
+  sol_pushvalue(L, o);  /* function must be on the top */
+  state.init = 0;
+  if (sol_dump(L, writer, &state, 0) != 0 || !state.init)
+    solL_error(L, "unable to dump function");
+  solL_pushresult(&state.B);
+  chunk = sol_tolstring(L, -1, &size);
+  saveByte(S, IMG_LCL);
+  saveVar(S, size);
+  saveBlock(S, chunk, size);
+  sol_pop(L, 2);  /* chunk and function */
+  for (nup = 0; sol_getupvalue(L, o, nup + 1) != NULL; nup++)
+    sol_pop(L, 1);
+  saveByte(S, nup);
+  for (n = 1; n <= nup; n++) {
+    sol_pushlightuserdata(L, sol_upvalueid(L, o, n));
+    if (sol_rawget(L, UPVALS) != SOL_TNIL) {  /* shared with earlier one? */
+      sol_Integer ref = sol_tointeger(L, -1);
+      saveByte(S, IMG_UPREF);
+      saveInt(S, (int)(ref >> 8));
+      saveByte(S, (int)(ref & 0xff));
+      sol_pop(L, 1);
+    }
+    else {
+      sol_pop(L, 1);
+      sol_pushlightuserdata(L, sol_upvalueid(L, o, n));
+      sol_pushinteger(L, ((sol_Integer)index << 8) | n);
+      sol_rawset(L, UPVALS);
+      sol_getupvalue(L, o, n);
+      saveValue(S, sol_gettop(L));
+      sol_pop(L, 1);
+    }
+  }
+}
+
+
+/*
+** Save the value at index 'o'. Each string, table and function gets
+** the next index the first time it is saved; later occurrences refer
+** to that index.
+*/
+static void saveValue (SaveState *S, int o) {
+  sol_State *L = S->L;
+  int t = sol_type(L, o);
+  int index;
+  switch (t) {
+    case SOL_TNIL: saveByte(S, IMG_NIL); return;
+    case SOL_TBOOLEAN:
+      saveByte(S, sol_toboolean(L, o) ? IMG_TRUE : IMG_FALSE);
+      return;
+    case SOL_TNUMBER: saveNumber(S, o); return;
+    default: break;
+  }
+  sol_pushvalue(L, o);
+  if (sol_rawget(L, OBJS) != SOL_TNIL) {  /* already saved? */
+    saveByte(S, IMG_REF);
+    saveInt(S, (int)sol_tointeger(L, -1));
+    sol_pop(L, 1);
+    return;
+  }
+  sol_pop(L, 1);
+  index = ++S->nobj;
+  sol_pushvalue(L, o);
+  sol_pushinteger(L, index);
+  sol_rawset(L, OBJS);
+  if (t == SOL_TSTRING) {
+    saveString(S, o);
+    return;
+  }
+  if (++S->depth > SOLI_MAXIMAGEDEPTH)
+    solL_error(L, "value too deep to be saved in an image");
+  solL_checkstack(L, 8, "too many nested values");
+  sol_pushvalue(L, o);
+  if (sol_rawget(L, NAMES) != SOL_TNIL) {  /* library value? */
+    int paths = sol_gettop(L);
+    int p, npaths = (int)sol_rawlen(L, paths);
+    saveByte(S, IMG_NAME);
+    saveByte(S, t);
+    saveByte(S, npaths);
+    for (p = 1; p <= npaths; p++) {
+      int i, n;
+      sol_rawgeti(L, paths, p);
+      n = (int)sol_rawlen(L, -1);
+      saveByte(S, n);
+      for (i = 1; i <= n; i++) {
+        sol_rawgeti(L, paths + 1, i);
+        saveValue(S, sol_gettop(L));
+        sol_pop(L, 1);
+      }
+      sol_pop(L, 1);
+    }
+    sol_pop(L, 1);
+    if (t == SOL_TTABLE)
+      saveTable(S, o);
+  }
+  else {
+    sol_pop(L, 1);
+    switch (t) {
+      case SOL_TTABLE:
+        saveByte(S, IMG_TABLE);
+        saveTable(S, o);
+        break;
+      case SOL_TFUNCTION:
+        if (sol_iscfunction(L, o))
+          solL_error(L, "cannot save a C function outside the loaded "
+                        "libraries");
+        saveFunction(S, o, index);
+        break;
+      default:
+        solL_error(L, "cannot save a %s in an image", solL_typename(L, o));
+    }
+  }
+  S->depth--;
+}
+
+
+static void saveHeader (SaveState *S) {
+  sol_Integer i = IMAGEINT;
+  sol_Number x = IMAGENUM;
+  saveBlock(S, IMAGESIGNATURE, sizeof(IMAGESIGNATURE) - 1);
+  saveByte(S, IMAGEFORMAT);
+  saveByte(S, sizeof(int));
+  saveByte(S, sizeof(size_t));
+  saveByte(S, sizeof(sol_Integer));
+  saveByte(S, sizeof(sol_Number));
+  saveVar(S, i);
+  saveVar(S, x);
+}
+
+
+static int psave (sol_State *L) {
+  SaveState *S = (SaveState *)sol_touserdata(L, 1);
+  sol_settop(L, 0);
+  sol_newtable(L);  /* OBJS */
+  sol_newtable(L);  /* NAMES */
+  sol_newtable(L);  /* UPVALS */
+  namelibs(L);
+  saveHeader(S);
+  sol_getfield(L, SOL_REGISTRYINDEX, SOL_LOADED_TABLE);
+  saveValue(S, sol_gettop(L));
+  return 0;
+}
+
+
+/*
+** Save an image of the loaded modules into file 'filename'. Returns
+** SOL_OK or an error code, with the error message on the top.
+*/
+SOLLIB_API int solL_saveimage (sol_State *L, const char *filename) {
+  SaveState S;
+  int status;
+  S.L = L;
+  S.nobj = 0;
+  S.depth = 0;
+  S.f = fopen(filename, "wb");
+  if (S.f == NULL) {
+    sol_pushfstring(L, "cannot open %s: %s", filename, strerror(errno));
+    return SOL_ERRFILE;
+  }
+  sol_pushcfunction(L, psave);
+  sol_pushlightuserdata(L, &S);
+  status = sol_pcall(L, 1, 0, 0);
+  if ((ferror(S.f) | fclose(S.f)) && status == SOL_OK) {
+    sol_pushfstring(L, "cannot write %s", filename);
+    status = SOL_ERRFILE;
+  }
+  if (status != SOL_OK)
+    remove(filename);  /* do not leave a broken image */
+  return status;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Loading
+** =======================================================
+*/
+
+typedef struct LoadState {
+  sol_State *L;
+  const char *p;  /* current position in the image */
+  size_t n;  /* bytes still unread */
+  int nobj;  /* number of objects loaded */
+  int depth;  /* nesting level */
+} LoadState;
+
+
+static void badimage (LoadState *S) {
+  solL_error(S->L, "bad image");
+}
+
+
+#define loadVar(S,x)	loadBlock(S, &(x), sizeof(x))
+
+static void loadBlock (LoadState *S, void *b, size_t size) {
+  if (size > S->n)
+    badimage(S);
+  memcpy(b, S->p, size);
+  S->p += size;
+  S->n -= size;
+}
+
+
+static int loadByte (LoadState *S) {
+  unsigned char x;
+  loadVar(S, x);
+  return x;
+}
+
+
+static int loadInt (LoadState *S) {
+  int i;
+  loadVar(S, i);
+  return i;
+}
+
+
+static void loadValue (LoadState *S);
+
+
+/*
+** Load the metatable and the contents of the table on the top. (Its
+** sizes were already read.)
+*/
+static void loadTable (LoadState *S) {
+  sol_State *L = S->L;
+  int t = sol_gettop(L);
+  loadValue(S);
+  if (sol_istable(L, -1))
+    sol_setmetatable(L, t);
+  else
+    sol_pop(L, 1);
+  for (;;) {
+    loadValue(S);  /* key */
+    if (sol_isnil(L, -1))  /* end of contents? */
+      break;
+    loadValue(S);
+    sol_rawset(L, t);
+  }
+  sol_pop(L, 1);
+}
+
+
+/* push the path with 'n' keys at index 'keys' as a string */
+static void pushpath (sol_State *L, int keys, int n) {
+  solL_Buffer B;
+  int i;
+  solL_buffinit(L, &B);
+  for (i = 0; i < n; i++) {
+    if (i > 0) solL_addchar(&B, '.');
+    sol_pushvalue(L, keys + i);
+    solL_addvalue(&B);
+  }
+  solL_pushresult(&B);
+}
+
+
+/*
+** Load an object named by its paths, leaving it on the top. A table
+** missing in this state is created anew; other values must exist.
+*/
+static void loadName (LoadState *S) {
+  sol_State *L = S->L;
+  int t = loadByte(S);
+  int npaths = loadByte(S);
+  int p, base = sol_gettop(L);
+  if (npaths == 0 || npaths > MAXPATHS)
+    badimage(S);
+  sol_pushnil(L);  /* object */
+  sol_pushnil(L);  /* first path, for error messages */
+  for (p = 0; p < npaths; p++) {
+    int i, n = loadByte(S);
+    if (n > MAXPATH)
+      badimage(S);
+    for (i = 0; i < n; i++)
+      loadValue(S);  /* keys */
+    if (sol_isnil(L, base + 1)) {  /* not found yet? */
+      sol_getfield(L, SOL_REGISTRYINDEX, SOL_LOADED_TABLE);
+      for (i = 0; i < n && sol_istable(L, -1); i++) {
+        sol_pushvalue(L, base + 3 + i);
+        sol_rawget(L, -2);
+        sol_remove(L, -2);
+      }
+      if (sol_type(L, -1) == t)
+        sol_replace(L, base + 1);
+      else {
+        sol_pop(L, 1);
+        if (p == 0) {
+          pushpath(L, base + 3, n);
+          sol_replace(L, base + 2);
+        }
+      }
+    }
+    sol_settop(L, base + 2);
+  }
+  if (sol_isnil(L, base + 1)) {  /* not found? */
+    if (t != SOL_TTABLE)
+      solL_error(L, "image refers to missing library value '%s'",
+                    sol_tostring(L, base + 2));
+    sol_newtable(L);
+    sol_replace(L, base + 1);
+  }
+  sol_settop(L, base + 1);
+}
+
+
+static void loadFunction (LoadState *S, int index) {
+  sol_State *L = S->L;
+  size_t size;
+  int f, n, nup;
+  loadVar(S, size);
+  if (size > S->n)
+    badimage(S);
+  if (solL_loadbufferx(L, S->p, size, "=(image)", "b") != SOL_OK)
+    sol_error(L);
+  S->p += size;
+  S->n -= size;
+  f = sol_gettop(L);
+  sol_pushvalue(L, f);
+  sol_rawseti(L, OBJS, index);  /* register it before its upvalues */
+  nup = loadByte(S);
+  for (n = 1; n <= nup; n++) {
+    if (S->n > 0 && *S->p == IMG_UPREF) {  /* shared upvalue? */
+      int ref, refn;
+      (void)loadByte(S);
+      ref = loadInt(S);
+      refn = loadByte(S);
+      if (sol_rawgeti(L, OBJS, ref) != SOL_TFUNCTION ||
+          sol_getupvalue(L, -1, refn) == NULL)
+        badimage(S);
+      sol_pop(L, 1);  /* upvalue value */
+      sol_upvaluejoin(L, f, n, -1, refn);
+      sol_pop(L, 1);
+    }
+    else {
+      loadValue(S);
+      if (sol_setupvalue(L, f, n) == NULL)
+        badimage(S);
+    }
+  }
+}
+
+
+/* load a value and push it on the stack */
+static void loadValue (LoadState *S) {
+  sol_State *L = S->L;
+  int tag = loadByte(S);
+  int index;
+  switch (tag) {
+    case IMG_NIL: sol_pushnil(L); return;
+    case IMG_FALSE: sol_pushboolean(L, 0); return;
+    case IMG_TRUE: sol_pushboolean(L, 1); return;
+    case IMG_INT: {
+      sol_Integer i;
+      loadVar(S, i);
+      sol_pushinteger(L, i);
+      return;
+    }
+    case IMG_FLT: {
+      sol_Number x;
+      loadVar(S, x);
+      sol_pushnumber(L, x);
+      return;
+    }
+    case IMG_STR: {
+      size_t size;
+      loadVar(S, size);
+      if (size > S->n)
+        badimage(S);
+      sol_pushlstring(L, S->p, size);
+      S->p += size;
+      S->n -= size;
+      sol_pushvalue(L, -1);
+      sol_rawseti(L, OBJS, ++S->nobj);
+      return;
+    }
+    case IMG_REF: {
+      index = loadInt(S);
+      if (index <= 0 || index > S->nobj ||
+          sol_rawgeti(L, OBJS, index) == SOL_TNIL)
+        badimage(S);
+      return;
+    }
+    default: break;
+  }
+  index = ++S->nobj;  /* reserve the index (before loading paths) */
+  if (++S->depth > SOLI_MAXIMAGEDEPTH)
+    badimage(S);
+  solL_checkstack(L, 8, "too many nested values");
+  switch (tag) {
+    case IMG_NAME: {
+      loadName(S);
+      sol_pushvalue(L, -1);
+      sol_rawseti(L, OBJS, index);
+      if (sol_istable(L, -1)) {
+        (void)loadInt(S);  /* sizes are not used */
+        (void)loadInt(S);
+        loadTable(S);
+      }
+      break;
+    }
+    case IMG_TABLE: {
+      int narr = loadInt(S);
+      int nrec = loadInt(S);
+      if (narr < 0 || nrec < 0)
+        badimage(S);
+      sol_createtable(L, narr, nrec);
+      sol_pushvalue(L, -1);
+      sol_rawseti(L, OBJS, index);
+      loadTable(S);
+      break;
+    }
+    case IMG_LCL: {
+      loadFunction(S, index);
+      break;
+    }
+    default: badimage(S);
+  }
+  S->depth--;
+}
+
+
+static void checkHeader (LoadState *S) {
+  char sig[sizeof(IMAGESIGNATURE) - 1];
+  sol_Integer i;
+  sol_Number x;
+  if (S->n < sizeof(sig) ||
+      memcmp(S->p, IMAGESIGNATURE, sizeof(sig)) != 0)
+    solL_error(S->L, "not an image");
+  loadVar(S, sig);
+  if (loadByte(S) != IMAGEFORMAT ||
+      loadByte(S) != sizeof(int) ||
+      loadByte(S) != sizeof(size_t) ||
+      loadByte(S) != sizeof(sol_Integer) ||
+      loadByte(S) != sizeof(sol_Number))
+    solL_error(S->L, "image format mismatch");
+  loadVar(S, i);
+  loadVar(S, x);
+  if (i != IMAGEINT || x != IMAGENUM)
+    solL_error(S->L, "image format mismatch");
+}
+
+
+static int pload (sol_State *L) {
+  LoadState *S = (LoadState *)sol_touserdata(L, 1);
+  sol_settop(L, 0);
+  sol_newtable(L);  /* OBJS */
+  checkHeader(S);
+  loadValue(S);  /* loaded table */
+  if (S->n != 0)
+    badimage(S);
+  return 0;
+}
+
+
+/*
+** Load the image in file 'filename' into the loaded modules of this
+** state. Returns SOL_OK or an error code, with the error message on the
+** top. (After an error, the state may be partially updated.)
+*/
+SOLLIB_API int solL_loadimage (sol_State *L, const char *filename) {
+  LoadState S;
+  FILE *f;
+  long size;
+  int status;
+  char *image;
+  f = fopen(filename, "rb");
+  if (f == NULL) {
+    sol_pushfstring(L, "cannot open %s: %s", filename, strerror(errno));
+    return SOL_ERRFILE;
+  }
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+      fseek(f, 0, SEEK_SET) != 0) {
+    fclose(f);
+    sol_pushfstring(L, "cannot read %s: %s", filename, strerror(errno));
+    return SOL_ERRFILE;
+  }
+  image = (char *)sol_newuserdatauv(L, (size_t)size, 0);
+  if (fread(image, 1, (size_t)size, f) != (size_t)size) {
+    fclose(f);
+    sol_pop(L, 1);
+    sol_pushfstring(L, "cannot read %s", filename);
+    return SOL_ERRFILE;
+  }
+  fclose(f);
+  S.L = L;
+  S.p = image;
+  S.n = (size_t)size;
+  S.nobj = 0;
+  S.depth = 0;
+  sol_pushcfunction(L, pload);
+  sol_pushlightuserdata(L, &S);
+  status = sol_pcall(L, 1, 0, 0);
+  sol_remove(L, (status == SOL_OK) ? -1 : -2);  /* remove image buffer */
+  return status;
+}
+
+/* }====================================================== */
+
@@ -67,6 +67,95 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** {======================================================
+** Bulk scanning: the characters following 'current' that are already
+** in the ZIO buffer ('z->n' of them, from 'z->p') are scanned directly,
+** and the span found is saved or skipped at once, instead of going one
+** character at a time through 'next' and 'save'. A span never includes
+** line breaks, so line counting is not affected.
+** =======================================================
+*/
+
+/* spaces other than line breaks */
+#define lexblank(c)	((c) == ' ' || (c) == '\t' || (c) == '\f' || (c) == '\v')
+
+static size_t span_blank (ZIO *z) {
+  size_t i;
+  for (i = 0; i < z->n && lexblank(z->p[i]); i++) ;
+  return i;
+}
+
+
+static size_t span_name (ZIO *z) {
+  size_t i;
+  for (i = 0; i < z->n && lislalnum(cast_uchar(z->p[i])); i++) ;
+  return i;
+}
+
+
+/* hexadecimal digits and dots, except the exponent marks in 'expo' */
+static size_t span_numeral (ZIO *z, const char *expo) {
+  size_t i;
+  for (i = 0; i < z->n; i++) {
+    int c = cast_uchar(z->p[i]);
+    if (!(lisxdigit(c) || c == '.') || c == expo[0] || c == expo[1])
+      break;
+  }
+  return i;
+}
+
+
+/* up to a line break or 'c1' or 'c2' */
+static size_t span_until (ZIO *z, int c1, int c2) {
+  size_t i;
+  for (i = 0; i < z->n; i++) {
+    int c = cast_uchar(z->p[i]);
+    if (c == '\n' || c == '\r' || c == c1 || c == c2)
+      break;
+  }
+  return i;
+}
+
+
+/*
+** Save 'current' and the next 'n' characters, which are in the ZIO
+** buffer, and read the character after them.
+*/
+static void savespan_and_next (LexState *ls, size_t n) {
+  Mbuffer *b = ls->buff;
+  ZIO *z = ls->z;
+  save(ls, ls->current);
+  if (solZ_sizebuffer(b) - solZ_bufflen(b) < n) {
+    size_t newsize = solZ_sizebuffer(b);
+    do {
+      if (newsize >= MAX_SIZE/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (newsize - solZ_bufflen(b) < n);
+    solZ_resizebuffer(ls->L, b, newsize);
+  }
+  memcpy(b->buffer + solZ_bufflen(b), z->p, n);
+  solZ_bufflen(b) += n;
+  z->p += n;
+  z->n -= n;
+  next(ls);
+}
+
+
+/*
+** Skip 'current' and the next 'n' characters, which are in the ZIO
+** buffer.
+*/
+static void skipspan_and_next (LexState *ls, size_t n) {
+  ls->z->p += n;
+  ls->z->n -= n;
+  next(ls);
+}
+
+/* }====================================================== */
+
+
 void solX_init (sol_State *L) {
   int i;
   TString *e = solS_newliteral(L, SOL_ENV);  /* create env name */
@@ -236,7 +325,7 @@ static int read_numeral (LexState *ls, SemInfo *seminfo) {
     if (check_next2(ls, expo))  /* exponent mark? */
       check_next2(ls, "-+");  /* optional exponent sign */
     else if (lisxdigit(ls->current) || ls->current == '.')  /* '%x|%.' */
-      save_and_next(ls);
+      savespan_and_next(ls, span_numeral(ls->z, expo));
     else break;
   }
   if (lislalpha(ls->current))  /* is numeral touching a letter? */
@@ -305,8 +394,9 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, size_t sep) {
         break;
       }
       default: {
-        if (seminfo) save_and_next(ls);
-        else next(ls);
+        size_t n = span_until(ls->z, ']', ']');
+        if (seminfo) savespan_and_next(ls, n);
+        else skipspan_and_next(ls, n);
       }
     }
   } endloop:
@@ -433,7 +523,7 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
        no_save: break;
       }
       default:
-        save_and_next(ls);
+        savespan_and_next(ls, span_until(ls->z, del, '\\'));
     }
   }
   save_and_next(ls);  /* skip delimiter */
@@ -451,7 +541,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
-        next(ls);
+        skipspan_and_next(ls, span_blank(ls->z));
         break;
       }
       case '-': {  /* '-' or '--' (comment) */
@@ -469,8 +559,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+        while (!currIsNewline(ls) && ls->current != EOZ)  /* skip until end */
+          skipspan_and_next(ls, span_until(ls->z, EOZ, EOZ));  /* of line */
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -539,8 +629,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
-          do {
-            save_and_next(ls);
+          do {  /* names split across buffers take more than one span */
+            savespan_and_next(ls, span_name(ls->z));
           } while (lislalnum(ls->current));
           ts = solX_newstring(ls, solZ_buffer(ls->buff),
                                   solZ_bufflen(ls->buff));
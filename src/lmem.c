@@ -58,6 +58,23 @@
 #define cantryagain(g)	(completestate(g) && !g->gcstopem)
 
 
+/*
+** An allocation that would take the heap over the state's memory
+** limit fails as if the allocator itself had no more memory, so it
+** goes through an emergency collection before raising an error.
+** ('osize' is the real size of the old block, not a tag.) Blocks
+** can always shrink.
+*/
+static int overlimit (global_State *g, size_t osize, size_t nsize) {
+  lu_mem total = gettotalbytes(g);
+  if (nsize <= osize)
+    return 0;
+  return (total > g->memlimit || nsize - osize > g->memlimit - total);
+}
+
+#define allocfits(g,os,ns)  (l_likely(g->memlimit == 0) || !overlimit(g,os,ns))
+
+
 
 
 #if defined(EMERGENCYGCTESTS)
@@ -144,12 +161,57 @@ l_noret solM_toobig (sol_State *L) {
 }
 
 
+/*
+** {==================================================================
+** Allocation sampling (see 'sol_setsampler')
+** ===================================================================
+*/
+
+/*
+** Count 'size' new bytes of block 'p' against the sampling interval and
+** report 'p' when the interval is exhausted. (A new object is not
+** initialized yet; the sampler can only look at the stack of 'L'.)
+** While 'gcstopem' is set the stack may be inconsistent, so the bytes
+** are not counted here; 'solD_reallocstack' counts them afterwards.
+*/
+void solM_sample_ (sol_State *L, const void *p, int tt, size_t size) {
+  global_State *g = G(L);
+  if (g->gcstopem)
+    return;
+  g->samplecount -= cast(l_mem, size);
+  if (g->samplecount <= 0) {
+    do {  /* a block larger than the interval counts only once */
+      g->samplecount += g->sampleinterval;
+    } while (g->samplecount <= 0);
+    g->samplef(g->ud_sample, L, p, NULL, tt, size);
+  }
+}
+
+
+/*
+** Report that block 'op' was freed ('p' == NULL) or resized to 'nsize'
+** bytes at 'p', counting its growth as new bytes.
+*/
+void solM_samplerealloc_ (sol_State *L, const void *op, size_t osize,
+                                        const void *p, size_t nsize) {
+  global_State *g = G(L);
+  if (op != NULL)
+    g->samplef(g->ud_sample, L, p, op, SOL_TNONE, nsize);
+  if (nsize > osize)
+    solM_sample_(L, p, SOL_TNONE, nsize - osize);
+}
+
+/* }================================================================== */
+
+
 /*
 ** Free memory
 */
 void solM_free_ (sol_State *L, void *block, size_t osize) {
   global_State *g = G(L);
   sol_assert((osize == 0) == (block == NULL));
+  if (l_unlikely(g->samplef != NULL))  /* sampling allocations? */
+    solM_samplerealloc_(L, block, osize, NULL, 0);
   callfrealloc(g, block, osize, 0);
   g->GCdebt -= osize;
 }
@@ -164,6 +226,8 @@ static void *tryagain (sol_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     solC_fullgc(L, 1);  /* try to free some memory... */
+    if (!allocfits(g, (block == NULL) ? 0 : osize, nsize))
+      return NULL;  /* still over the limit */
     return callfrealloc(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
@@ -177,7 +241,9 @@ void *solM_realloc_ (sol_State *L, void *block, size_t osize, size_t nsize) {
   void *newblock;
   global_State *g = G(L);
   sol_assert((osize == 0) == (block == NULL));
-  newblock = firsttry(g, block, osize, nsize);
+  newblock = allocfits(g, osize, nsize)
+           ? firsttry(g, block, osize, nsize)
+           : NULL;
   if (l_unlikely(newblock == NULL && nsize > 0)) {
     newblock = tryagain(L, block, osize, nsize);
     if (newblock == NULL)  /* still no memory? */
@@ -185,6 +251,8 @@ void *solM_realloc_ (sol_State *L, void *block, size_t osize, size_t nsize) {
   }
   sol_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - osize;
+  if (l_unlikely(g->samplef != NULL))  /* sampling allocations? */
+    solM_samplerealloc_(L, block, osize, newblock, nsize);
   return newblock;
 }
 
@@ -203,13 +271,17 @@ void *solM_malloc_ (sol_State *L, size_t size, int tag) {
     return NULL;  /* that's all */
   else {
     global_State *g = G(L);
-    void *newblock = firsttry(g, NULL, tag, size);
+    void *newblock = allocfits(g, 0, size)
+                   ? firsttry(g, NULL, tag, size)
+                   : NULL;
     if (l_unlikely(newblock == NULL)) {
       newblock = tryagain(L, NULL, tag, size);
       if (newblock == NULL)
         solM_error(L);
     }
     g->GCdebt += size;
+    if (l_unlikely(g->samplef != NULL))  /* sampling allocations? */
+      solM_sample_(L, newblock, (tag != 0) ? tag : SOL_TNONE, size);
     return newblock;
   }
 }
@@ -88,6 +88,20 @@ SOLI_FUNC void *solM_growaux_ (sol_State *L, void *block, int nelems,
 SOLI_FUNC void *solM_shrinkvector_ (sol_State *L, void *block, int *nelem,
                                     int final_n, int size_elem);
 SOLI_FUNC void *solM_malloc_ (sol_State *L, size_t size, int tag);
+SOLI_FUNC void solM_sample_ (sol_State *L, const void *p, int tt,
+                                           size_t size);
+SOLI_FUNC void solM_samplerealloc_ (sol_State *L, const void *op,
+                                    size_t osize, const void *p, size_t nsize);
+
+
+/*
+** Allocation sampling for blocks reused without going through the
+** functions above (e.g., pooled threads): 'solM_sample' counts a block
+** as new and 'solM_samplefree' reports it as freed.
+*/
+#define solM_sample(L,p,tt,s) 	(l_unlikely(G(L)->samplef != NULL) ? solM_sample_(L,p,tt,s) 	                                   : cast_void(0))
+
+#define solM_samplefree(L,p) 	(l_unlikely(G(L)->samplef != NULL) 	   ? solM_samplerealloc_(L,p,0,NULL,0) : cast_void(0))
 
 #endif
 
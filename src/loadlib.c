@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "sol.h"
 
@@ -24,6 +25,13 @@
 #include "sollib.h"
 
 
+#if defined(SOL_USE_POSIX)
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+
 /*
 ** SOL_CSUBSEP is the character that replaces dots in submodule names
 ** when searching for a C loader.
@@ -268,6 +276,14 @@ static sol_CFunction lsys_sym (sol_State *L, void *lib, const char *sym) {
 #define SOL_CPATH_VAR   "SOL_CPATH"
 #endif
 
+/*
+** SOL_CACHEDIR_VAR is the name of the environment variable that sets
+** the directory for compiled modules ('package.cachedir').
+*/
+#if !defined(SOL_CACHEDIR_VAR)
+#define SOL_CACHEDIR_VAR	"SOL_CACHEDIR"
+#endif
+
 
 
 /*
@@ -317,6 +333,23 @@ static void setpath (sol_State *L, const char *fieldname,
   sol_pop(L, 1);  /* pop versioned variable name ('nver') */
 }
 
+
+/*
+** Set 'package.cachedir' from its environment variable, if present
+*/
+static void setcachedir (sol_State *L) {
+  const char *nver = sol_pushfstring(L, "%s%s", SOL_CACHEDIR_VAR,
+                                                SOL_VERSUFFIX);
+  const char *dir = getenv(nver);  /* try versioned name */
+  if (dir == NULL)  /* no versioned environment variable? */
+    dir = getenv(SOL_CACHEDIR_VAR);  /* try unversioned name */
+  if (dir != NULL && *dir != '\0' && !noenv(L)) {
+    sol_pushstring(L, dir);
+    sol_setfield(L, -3, "cachedir");
+  }
+  sol_pop(L, 1);  /* pop versioned variable name ('nver') */
+}
+
 /* }================================================================== */
 
 
@@ -430,6 +463,160 @@ static int readable (const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Search cache: when 'package.searchcache' is true, 'findfile' keeps
+** the result of each search (the file found or the error message) per
+** path and module name, so that later searches do not probe files.
+** When it is "index", files are also checked against a listing of
+** their directories, read once, before being probed. Entries are
+** dropped by 'package.clearcache'; 'package.searchstats' reports the
+** counters below.
+** =======================================================
+*/
+
+/* key, in the registry, for the search cache */
+static const char *const SEARCHCACHE = "_SEARCHCACHE";
+
+typedef struct SearchCache {
+  sol_Integer hits;  /* searches answered by the cache */
+  sol_Integer misses;  /* searches done */
+  sol_Integer probes;  /* files probed */
+  sol_Integer avoided;  /* probes avoided by directory listings */
+  int useindex;  /* check directory listings before probing? */
+} SearchCache;
+
+
+/*
+** Push the search cache, creating it if needed. Its first user value
+** maps each path to a table of results; the second maps directories to
+** their listings (or true when they cannot be listed).
+*/
+static SearchCache *getsearchcache (sol_State *L) {
+  SearchCache *sc;
+  if (sol_getfield(L, SOL_REGISTRYINDEX, SEARCHCACHE) == SOL_TUSERDATA)
+    return (SearchCache *)sol_touserdata(L, -1);
+  sol_pop(L, 1);
+  sc = (SearchCache *)sol_newuserdatauv(L, sizeof(SearchCache), 2);
+  memset(sc, 0, sizeof(SearchCache));
+  sol_newtable(L);
+  sol_setiuservalue(L, -2, 1);
+  sol_newtable(L);
+  sol_setiuservalue(L, -2, 2);
+  sol_pushvalue(L, -1);
+  sol_setfield(L, SOL_REGISTRYINDEX, SEARCHCACHE);
+  return sc;
+}
+
+
+#if defined(SOL_USE_POSIX)
+
+/* push a set with the entries of directory 'dir' */
+static void listdir (sol_State *L, const char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  if (d == NULL) {
+    if (errno == ENOENT || errno == ENOTDIR)  /* no such directory? */
+      sol_newtable(L);  /* so, no files */
+    else
+      sol_pushboolean(L, 1);  /* unknown; must probe its files */
+    return;
+  }
+  sol_newtable(L);
+  while ((e = readdir(d)) != NULL) {
+    sol_pushboolean(L, 1);
+    sol_setfield(L, -2, e->d_name);
+  }
+  closedir(d);
+}
+
+#else
+
+#define listdir(L,dir)	((void)(dir), sol_pushboolean(L, 1))
+
+#endif
+
+
+/*
+** Check whether 'filename' may exist, according to the listing of its
+** directory in the search cache at index 'cache'.
+*/
+static int inlisting (sol_State *L, int cache, const char *filename) {
+  const char *base = strrchr(filename, *SOL_DIRSEP);
+  int res;
+  sol_getiuservalue(L, cache, 2);
+  if (base == NULL) {  /* file in the current directory? */
+    sol_pushliteral(L, ".");
+    base = filename;
+  }
+  else {
+    size_t l = (size_t)(base - filename);
+    sol_pushlstring(L, filename, (l == 0) ? 1 : l);  /* keep root '/' */
+    base++;
+  }
+  sol_pushvalue(L, -1);
+  if (sol_rawget(L, -3) == SOL_TNIL) {  /* directory not listed yet? */
+    sol_pop(L, 1);
+    listdir(L, sol_tostring(L, -1));
+    sol_pushvalue(L, -2);
+    sol_pushvalue(L, -2);
+    sol_rawset(L, -5);  /* listings[dir] = listing */
+  }
+  if (sol_istable(L, -1))
+    res = (sol_getfield(L, -1, base) != SOL_TNIL);
+  else {  /* unknown */
+    sol_pushnil(L);
+    res = 1;
+  }
+  sol_pop(L, 4);
+  return res;
+}
+
+
+/*
+** Check whether 'filename' exists and is readable, updating the search
+** cache at index 'cache' (if not zero).
+*/
+static int probe (sol_State *L, int cache, const char *filename) {
+  if (cache != 0) {
+    SearchCache *sc = (SearchCache *)sol_touserdata(L, cache);
+    if (sc->useindex && !inlisting(L, cache, filename)) {
+      sc->avoided++;
+      return 0;
+    }
+    sc->probes++;
+  }
+  return readable(filename);
+}
+
+
+static int ll_clearcache (sol_State *L) {
+  getsearchcache(L);
+  sol_newtable(L);
+  sol_setiuservalue(L, -2, 1);
+  sol_newtable(L);
+  sol_setiuservalue(L, -2, 2);
+  return 0;
+}
+
+
+static int ll_searchstats (sol_State *L) {
+  SearchCache *sc = getsearchcache(L);
+  sol_createtable(L, 0, 4);
+  sol_pushinteger(L, sc->hits);
+  sol_setfield(L, -2, "hits");
+  sol_pushinteger(L, sc->misses);
+  sol_setfield(L, -2, "misses");
+  sol_pushinteger(L, sc->probes);
+  sol_setfield(L, -2, "probes");
+  sol_pushinteger(L, sc->avoided);
+  sol_setfield(L, -2, "avoided");
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Get the next name in '*path' = 'name1;name2;name3;...', changing
 ** the ending ';' to '\0' to create a zero-terminated string. Return
@@ -472,7 +659,8 @@ static void pusherrornotfound (sol_State *L, const char *path) {
 static const char *searchpath (sol_State *L, const char *name,
                                              const char *path,
                                              const char *sep,
-                                             const char *dirsep) {
+                                             const char *dirsep,
+                                             int cache) {
   solL_Buffer buff;
   char *pathname;  /* path with name inserted */
   char *endpathname;  /* its end */
@@ -487,7 +675,7 @@ static const char *searchpath (sol_State *L, const char *name,
   pathname = solL_buffaddr(&buff);  /* writable list of file names */
   endpathname = pathname + solL_bufflen(&buff) - 1;
   while ((filename = getnextfilename(&pathname, endpathname)) != NULL) {
-    if (readable(filename))  /* does file exist and is readable? */
+    if (probe(L, cache, filename))  /* does file exist and is readable? */
       return sol_pushstring(L, filename);  /* save and return name */
   }
   solL_pushresult(&buff);  /* push path to create error message */
@@ -500,7 +688,7 @@ static int ll_searchpath (sol_State *L) {
   const char *f = searchpath(L, solL_checkstring(L, 1),
                                 solL_checkstring(L, 2),
                                 solL_optstring(L, 3, "."),
-                                solL_optstring(L, 4, SOL_DIRSEP));
+                                solL_optstring(L, 4, SOL_DIRSEP), 0);
   if (f != NULL) return 1;
   else {  /* error message is on top of the stack */
     solL_pushfail(L);
@@ -510,6 +698,54 @@ static int ll_searchpath (sol_State *L) {
 }
 
 
+/*
+** Search 'name' in 'path' through the search cache (see 'findfile').
+*/
+static const char *cachedsearch (sol_State *L, const char *name,
+                                               const char *path,
+                                               const char *dirsep) {
+  SearchCache *sc = getsearchcache(L);
+  int cache = sol_gettop(L);
+  int results;
+  const char *filename;
+  sol_getfield(L, sol_upvalueindex(1), "searchcache");
+  if (!sol_toboolean(L, -1)) {  /* cache disabled? */
+    sc->useindex = 0;
+    return searchpath(L, name, path, ".", dirsep, cache);
+  }
+  sc->useindex = (sol_type(L, -1) == SOL_TSTRING &&
+                  strcmp(sol_tostring(L, -1), "index") == 0);
+  sol_getiuservalue(L, cache, 1);
+  if (sol_getfield(L, -1, path) != SOL_TTABLE) {  /* new path? */
+    sol_pop(L, 1);
+    sol_newtable(L);
+    sol_pushvalue(L, -1);
+    sol_setfield(L, -3, path);
+  }
+  results = sol_gettop(L);
+  switch (sol_getfield(L, results, name)) {
+    case SOL_TSTRING:  /* file found before */
+      sc->hits++;
+      return sol_tostring(L, -1);
+    case SOL_TTABLE:  /* not found before */
+      sc->hits++;
+      sol_rawgeti(L, -1, 1);  /* error message */
+      return NULL;
+    default: break;
+  }
+  sc->misses++;
+  filename = searchpath(L, name, path, ".", dirsep, cache);
+  sol_pushvalue(L, -1);  /* file name or error message */
+  if (filename == NULL) {  /* box error message */
+    sol_createtable(L, 1, 0);
+    sol_insert(L, -2);
+    sol_rawseti(L, -2, 1);
+  }
+  sol_setfield(L, results, name);
+  return filename;
+}
+
+
 static const char *findfile (sol_State *L, const char *name,
                                            const char *pname,
                                            const char *dirsep) {
@@ -518,7 +754,7 @@ static const char *findfile (sol_State *L, const char *name,
   path = sol_tostring(L, -1);
   if (l_unlikely(path == NULL))
     solL_error(L, "'package.%s' must be a string", pname);
-  return searchpath(L, name, path, ".", dirsep);
+  return cachedsearch(L, name, path, dirsep);
 }
 
 
@@ -533,12 +769,279 @@ static int checkload (sol_State *L, int stat, const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Cache of compiled modules: when 'package.cachedir' is a string, each
+** module loaded by 'searcher_Sol' is compiled once and its binary chunk
+** kept in that directory, in an entry named after a hash of the
+** module's file name. The entry records the file name and a hash of
+** the source, so a stale entry (or one for another file with the same
+** hash) is recompiled, and a hash of the chunk, so a corrupt one is
+** ignored. (Chunks for other Sol versions fail to load, and are also
+** recompiled.) Entries are written into a temporary file and then
+** renamed, so concurrent processes never see partial entries.
+** =======================================================
+*/
+
+/* mark for cache entries ('<esc>SolCache') */
+#define CACHESIGNATURE	"\x1bSolCache"
+
+#define CACHESUFFIX	".solc"
+
+/* seed for hashes (different Sol versions use different entries) */
+#define CACHESEED	hashbytes(~(sol_Unsigned)0, SOL_RELEASE, \
+                                  sizeof(SOL_RELEASE) - 1)
+
+
+static sol_Unsigned hashbytes (sol_Unsigned h, const char *s, size_t l) {
+  for (; l > 0; l--)
+    h ^= ((h << 5) + (h >> 2) + (unsigned char)s[l - 1]);
+  return h;
+}
+
+
+/*
+** Read file 'fname' and push its contents. Returns 0 (pushing nothing)
+** if the file cannot be read.
+*/
+static int readfile (sol_State *L, const char *fname) {
+  solL_Buffer b;
+  size_t n;
+  int err;
+  FILE *f = fopen(fname, "rb");
+  if (f == NULL)
+    return 0;
+  solL_buffinit(L, &b);
+  do {
+    char *p = solL_prepbuffer(&b);
+    n = fread(p, 1, SOLL_BUFFERSIZE, f);
+    solL_addsize(&b, n);
+  } while (n == SOLL_BUFFERSIZE);
+  err = ferror(f);
+  fclose(f);
+  solL_pushresult(&b);
+  if (err) {
+    sol_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+
+/* push the name of the cache entry for file 'fname' */
+static const char *entryname (sol_State *L, const char *dir,
+                                            const char *fname) {
+  char buff[2 * sizeof(sol_Unsigned) + 1];
+  sol_Unsigned h = hashbytes(CACHESEED, fname, strlen(fname));
+  int i;
+  for (i = (int)sizeof(buff) - 2; i >= 0; i--) {
+    buff[i] = "0123456789abcdef"[h & 0xf];
+    h >>= 4;
+  }
+  buff[sizeof(buff) - 1] = '\0';
+  return sol_pushfstring(L, "%s" SOL_DIRSEP "%s" CACHESUFFIX, dir, buff);
+}
+
+
+typedef struct CacheHeader {
+  sol_Unsigned srchash;  /* hash of the source */
+  sol_Unsigned chunkhash;  /* hash of the binary chunk */
+  size_t srclen;  /* size of the source */
+  size_t namelen;  /* size of the file name (which follows the header) */
+  size_t chunklen;  /* size of the binary chunk (which follows the name) */
+} CacheHeader;
+
+
+/*
+** Load the chunk in the cache entry on the top, if it is valid for
+** file 'fname' with source hash 'srchash' and size 'srclen'. Returns
+** true and replaces the entry with the function if it succeeds.
+*/
+static int loadentry (sol_State *L, const char *fname, sol_Unsigned srchash,
+                                    size_t srclen) {
+  const size_t siglen = sizeof(CACHESIGNATURE) - 1;
+  CacheHeader h;
+  size_t len;
+  const char *e = sol_tolstring(L, -1, &len);
+  const char *chunk;
+  if (len < siglen + sizeof(h) || memcmp(e, CACHESIGNATURE, siglen) != 0)
+    return 0;
+  memcpy(&h, e + siglen, sizeof(h));
+  if (h.srchash != srchash || h.srclen != srclen ||
+      h.namelen != strlen(fname) ||
+      len - siglen - sizeof(h) < h.namelen ||
+      len - siglen - sizeof(h) - h.namelen != h.chunklen)
+    return 0;  /* stale entry or not for this file */
+  e += siglen + sizeof(h);
+  chunk = e + h.namelen;
+  if (memcmp(e, fname, h.namelen) != 0 ||
+      hashbytes(CACHESEED, chunk, h.chunklen) != h.chunkhash)
+    return 0;  /* another file or corrupt entry */
+  if (solL_loadbufferx(L, chunk, h.chunklen, fname, "b") != SOL_OK) {
+    sol_pop(L, 1);  /* error message */
+    return 0;  /* e.g., chunk from another version */
+  }
+  sol_remove(L, -2);  /* remove entry */
+  return 1;
+}
+
+
+struct Writer {
+  int init;  /* true iff buffer has been initialized */
+  solL_Buffer B;
+};
+
+
+static int writer (sol_State *L, const void *b, size_t size, void *ud) {
+  struct Writer *state = (struct Writer *)ud;
+  if (!state->init) {
+    state->init = 1;
+    solL_buffinit(L, &state->B);
+  }
+  solL_addlstring(&state->B, (const char *)b, size);
+  return 0;
+}
+
+
+#if defined(SOL_USE_POSIX)
+
+/*
+** Create a new temporary file for cache entry 'entry', leaving its name
+** in '*tmp' (anchored on the stack). 'mkstemp' creates the file
+** exclusively, so concurrent writers never share a temporary file.
+*/
+static FILE *opentemp (sol_State *L, const char *entry, const char **tmp) {
+  static const char suffix[] = ".XXXXXX";
+  size_t len = strlen(entry);
+  char *name = (char *)sol_newuserdatauv(L, len + sizeof(suffix), 0);
+  FILE *f;
+  int fd;
+  memcpy(name, entry, len);
+  memcpy(name + len, suffix, sizeof(suffix));
+  *tmp = name;
+  fd = mkstemp(name);
+  if (fd == -1)
+    return NULL;
+  f = fdopen(fd, "wb");
+  if (f == NULL) {
+    close(fd);
+    remove(name);
+  }
+  return f;
+}
+
+#else
+
+/*
+** Without 'mkstemp', the name of the temporary file mixes an address and
+** the clock, which makes a clash between writers unlikely.
+*/
+static FILE *opentemp (sol_State *L, const char *entry, const char **tmp) {
+  *tmp = sol_pushfstring(L, "%s.%p%d.tmp", entry, (void *)tmp, (int)clock());
+  return fopen(*tmp, "wb");
+}
+
+#endif
+
+
+/*
+** Save the function on the top (loaded from file 'fname') in cache
+** entry 'entry'. Errors are ignored: the cache is only an optimization.
+*/
+static void saveentry (sol_State *L, const char *entry, const char *fname,
+                       sol_Unsigned srchash, size_t srclen) {
+  CacheHeader h;
+  struct Writer w;
+  const char *chunk, *tmp;
+  FILE *f;
+  int ok;
+  w.init = 0;
+  sol_dump(L, writer, &w, 0);
+  if (!w.init)
+    return;  /* nothing written */
+  solL_pushresult(&w.B);
+  memset(&h, 0, sizeof(h));  /* clear padding */
+  chunk = sol_tolstring(L, -1, &h.chunklen);
+  h.srchash = srchash;
+  h.chunkhash = hashbytes(CACHESEED, chunk, h.chunklen);
+  h.srclen = srclen;
+  h.namelen = strlen(fname);
+  f = opentemp(L, entry, &tmp);
+  if (f != NULL) {
+    ok = (fwrite(CACHESIGNATURE, 1, sizeof(CACHESIGNATURE) - 1, f) ==
+            sizeof(CACHESIGNATURE) - 1 &&
+          fwrite(&h, sizeof(h), 1, f) == 1 &&
+          fwrite(fname, 1, h.namelen, f) == h.namelen &&
+          fwrite(chunk, 1, h.chunklen, f) == h.chunklen);
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp, entry) != 0)
+      remove(tmp);
+  }
+  sol_pop(L, 2);  /* chunk and temporary name */
+}
+
+
+/*
+** Load file 'fname' through the cache in directory 'dir'. The source is
+** compiled from the same buffer that was hashed, after skipping an
+** optional BOM and first-line comment as in 'solL_loadfilex'.
+*/
+static int loadcached (sol_State *L, const char *fname, const char *dir) {
+  size_t len, srclen;
+  const char *src, *entry;
+  sol_Unsigned srchash;
+  int status;
+  if (!readfile(L, fname))
+    return solL_loadfile(L, fname);  /* let it report the error */
+  src = sol_tolstring(L, -1, &srclen);
+  len = srclen;
+  srchash = hashbytes(CACHESEED, src, len);
+  if (len >= 3 && memcmp(src, "\xEF\xBB\xBF", 3) == 0) {  /* BOM? */
+    src += 3; len -= 3;
+  }
+  if (len > 0 && *src == '#') {  /* first-line comment? */
+    const char *nl = (const char *)memchr(src, '\n', len);
+    size_t n = (nl != NULL) ? (size_t)(nl - src) : len;
+    src += n; len -= n;  /* keep the newline */
+  }
+  if (len > 0 && *src == SOL_SIGNATURE[0]) {  /* binary file? */
+    sol_pop(L, 1);
+    return solL_loadfile(L, fname);  /* nothing to cache */
+  }
+  entry = entryname(L, dir, fname);
+  if (readfile(L, entry)) {
+    if (loadentry(L, fname, srchash, srclen)) {
+      sol_replace(L, -3);  /* function replaces source */
+      sol_pop(L, 1);  /* entry name */
+      return SOL_OK;
+    }
+    sol_pop(L, 1);  /* invalid entry */
+  }
+  sol_pushfstring(L, "@%s", fname);
+  status = solL_loadbufferx(L, src, len, sol_tostring(L, -1), "t");
+  sol_remove(L, -2);  /* chunk name */
+  if (status == SOL_OK)
+    saveentry(L, entry, fname, srchash, srclen);
+  sol_replace(L, -3);  /* function or error replaces source */
+  sol_pop(L, 1);  /* entry name */
+  return status;
+}
+
+/* }====================================================== */
+
+
 static int searcher_Sol (sol_State *L) {
   const char *filename;
   const char *name = solL_checkstring(L, 1);
+  int status;
   filename = findfile(L, name, "path", SOL_LSUBSEP);
   if (filename == NULL) return 1;  /* module not found in this path */
-  return checkload(L, (solL_loadfile(L, filename) == SOL_OK), filename);
+  if (sol_getfield(L, sol_upvalueindex(1), "cachedir") == SOL_TSTRING)
+    status = loadcached(L, filename, sol_tostring(L, -1));
+  else
+    status = solL_loadfile(L, filename);
+  sol_remove(L, -2);  /* remove 'cachedir' */
+  return checkload(L, (status == SOL_OK), filename);
 }
 
 
@@ -682,6 +1185,8 @@ static int ll_require (sol_State *L) {
 static const solL_Reg pk_funcs[] = {
   {"loadlib", ll_loadlib},
   {"searchpath", ll_searchpath},
+  {"clearcache", ll_clearcache},
+  {"searchstats", ll_searchstats},
   /* placeholders */
   {"preload", NULL},
   {"cpath", NULL},
@@ -739,6 +1244,7 @@ SOLMOD_API int solopen_package (sol_State *L) {
   /* set paths */
   setpath(L, "path", SOL_PATH_VAR, SOL_PATH_DEFAULT);
   setpath(L, "cpath", SOL_CPATH_VAR, SOL_CPATH_DEFAULT);
+  setcachedir(L);
   /* store config information */
   sol_pushliteral(L, SOL_DIRSEP "\n" SOL_PATH_SEP "\n" SOL_PATH_MARK "\n"
                      SOL_EXEC_DIR "\n" SOL_IGMARK "\n");
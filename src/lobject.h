@@ -544,6 +544,19 @@ typedef struct AbsLineInfo {
   int line;
 } AbsLineInfo;
 
+/*
+** Flags in Proto: PF_FIXED means that 'code', 'lineinfo' and
+** 'abslineinfo' point into the (fixed) buffer the prototype was loaded
+** from, instead of memory owned by the prototype. PF_STRINGS means
+** that the body of a lazy prototype was saved with its own string table
+** (see 'SOLC_FORMATSTRINGS').
+*/
+#define PF_FIXED	1
+#define PF_STRINGS	2
+
+#define isfixed(f)	((f)->flag & PF_FIXED)
+
+
 /*
 ** Function Prototypes
 */
@@ -552,6 +565,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte flag;  /* PF_FIXED, PF_STRINGS */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -569,6 +583,8 @@ typedef struct Proto {
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
+  const char *lazy;  /* body not loaded yet (see 'solU_loadlazy') */
+  struct LClosure *cache;  /* last-created closure with this prototype */
   GCObject *gclist;
 } Proto;
 
@@ -734,6 +750,14 @@ typedef union Node {
 #define setnorealasize(t)	((t)->flags |= BITRAS)
 
 
+/*
+** Bit 6 of 'flags' signals that the table has a card table, right after
+** its hash part (see 'ltable.h')
+*/
+#define BITCARDS	(1 << 6)
+#define hascards(t)	((t)->flags & BITCARDS)
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -1964,3 +1964,228 @@ LClosure *solY_parser (sol_State *L, ZIO *z, Mbuffer *buff,
   return cl;  /* closure is on the stack, too */
 }
 
+
+
+/*
+** {======================================================================
+** Data chunks: a restricted syntax, with only literals and constructors,
+** that is parsed straight into values, without generating code:
+**   data -> ['return'] value [';'] EOS
+**   value -> nil | true | false | ['-'] Numeral | LiteralString | table
+**   table -> '{' [field {sep field} [sep]] '}'
+**   field -> NAME '=' value | '[' value ']' '=' value | value
+** Fields are assigned as the equivalent constructor would assign them.
+** =======================================================================
+*/
+
+/* maximum number of fields kept in the stack before stored in a table */
+#if !defined(SOLI_DATAFLUSH)
+#define SOLI_DATAFLUSH	1024
+#endif
+
+
+static void datavalue (LexState *ls);
+
+
+/*
+** Store into table 't' the positional fields in the 'n' pairs at 'base'
+** (the ones pending since the last flush), after the 'na' already
+** stored.
+*/
+static void storelist (sol_State *L, Table *t, StkId base, int n,
+                       unsigned int *na) {
+  int i;
+  for (i = 0; i < n; i++) {
+    TValue *val = s2v(base + 2 * i + 1);
+    if (*na < solH_realasize(t)) {  /* in the array part? */
+      TValue *slot = &t->array[*na];
+      setobj2t(L, slot, val);
+      solC_barrierslot(L, t, slot, val);
+    }
+    else {  /* a rehash for a keyed field may have shrunk the array */
+      solH_setint(L, t, *na + 1, val);
+      solC_barrierslot(L, t, solH_getint(t, *na + 1), val);
+    }
+    (*na)++;
+  }
+}
+
+
+/*
+** Store into table 't' the 'n' fields on the top of the stack, each a
+** key-value pair with a nil key for positional fields, in the order a
+** compiled constructor does: keyed fields at once, positional ones in
+** groups of LFIELDS_PER_FLUSH, each group when the next field starts
+** (see 'closelistfield'). The first 'np' pairs are positional fields
+** pending from the previous call and 'na' counts the positional fields
+** already stored. Unless 'last', positional fields still pending stay
+** on the stack as the first pairs for the next call; returns how many.
+** The first time ('first'), the table is presized for all the fields;
+** later, its array part at least doubles.
+*/
+static int storefields (LexState *ls, Table *t, int n, int np,
+                        unsigned int *na, int first, int last) {
+  sol_State *L = ls->L;
+  StkId base = L->top.p - 2 * n;
+  unsigned int nna = *na;
+  unsigned int nh = 0;
+  int i;
+  for (i = 0; i < n; i++) {  /* count positional and keyed fields */
+    if (ttisnil(s2v(base + 2 * i))) nna++;
+    else nh++;
+  }
+  if (first)
+    solH_resize(L, t, nna, nh);
+  else if (nna > solH_realasize(t)) {
+    unsigned int size = solH_realasize(t);
+    solH_resizearray(L, t, (nna / 2 > size) ? nna : 2 * size);
+  }
+  for (i = np; i < n; i++) {
+    TValue *key = s2v(base + 2 * i);
+    TValue *val = s2v(base + 2 * i + 1);
+    if (np == LFIELDS_PER_FLUSH) {  /* a field after a full group? */
+      storelist(L, t, base, np, na);
+      np = 0;
+    }
+    if (ttisnil(key)) {  /* positional field? */
+      setobjs2s(L, base + 2 * np + 1, base + 2 * i + 1);  /* keep it */
+      setnilvalue(s2v(base + 2 * np));
+      np++;
+    }
+    else {  /* (a nil value removes a previous field with that key) */
+      solH_set(L, t, key, val);
+      if (!ttisnil(val))
+        solC_barrierslot(L, t, solH_get(t, key), val);
+    }
+  }
+  if (last) {
+    storelist(L, t, base, np, na);
+    np = 0;
+  }
+  L->top.p = base + 2 * np;
+  return np;
+}
+
+
+static void datafield (LexState *ls) {
+  sol_State *L = ls->L;
+  solD_checkstack(L, 2);
+  if (ls->t.token == TK_NAME) {  /* names are only keys */
+    setsvalue2s(L, L->top.p, ls->t.seminfo.ts);
+    L->top.p++;
+    solX_next(ls);  /* skip name */
+    checknext(ls, '=');
+  }
+  else if (ls->t.token == '[') {
+    TValue *key;
+    solX_next(ls);  /* skip '[' */
+    datavalue(ls);
+    key = s2v(L->top.p - 1);
+    if (ttisnil(key))
+      solX_syntaxerror(ls, "table index is nil");
+    else if (ttisfloat(key) && soli_numisnan(fltvalue(key)))
+      solX_syntaxerror(ls, "table index is NaN");
+    checknext(ls, ']');
+    checknext(ls, '=');
+  }
+  else {  /* positional field */
+    setnilvalue(s2v(L->top.p));
+    L->top.p++;
+  }
+  datavalue(ls);
+}
+
+
+static void datatable (LexState *ls) {
+  sol_State *L = ls->L;
+  int line = ls->linenumber;
+  Table *t = solH_new(L);
+  unsigned int na = 0;
+  int n = 0;
+  int first = 1;
+  int np = 0;  /* positional fields pending on the stack */
+  sethvalue2s(L, L->top.p, t);
+  L->top.p++;
+  enterlevel(ls);
+  checknext(ls, '{');
+  while (ls->t.token != '}') {
+    datafield(ls);
+    if (++n == SOLI_DATAFLUSH) {
+      n = np = storefields(ls, t, n, np, &na, first, 0);
+      first = 0;
+    }
+    if (!testnext(ls, ',') && !testnext(ls, ';'))
+      break;
+  }
+  storefields(ls, t, n, np, &na, first, 1);
+  leavelevel(ls);
+  solC_checkGC(L);
+  check_match(ls, '}', '{', line);
+}
+
+
+/*
+** Push the value of the current token(s) and skip them.
+*/
+static void datavalue (LexState *ls) {
+  sol_State *L = ls->L;
+  TValue *v = s2v(L->top.p);
+  switch (ls->t.token) {
+    case TK_NIL: setnilvalue(v); break;
+    case TK_TRUE: setbtvalue(v); break;
+    case TK_FALSE: setbfvalue(v); break;
+    case TK_INT: setivalue(v, ls->t.seminfo.i); break;
+    case TK_FLT: setfltvalue(v, ls->t.seminfo.r); break;
+    case TK_STRING: setsvalue(L, v, ls->t.seminfo.ts); break;
+    case '-': {  /* negative numeral */
+      solX_next(ls);
+      v = s2v(L->top.p);  /* 'solX_next' can reallocate the stack */
+      if (ls->t.token == TK_INT) {
+        setivalue(v, l_castU2S(0u - l_castS2U(ls->t.seminfo.i)));
+      }
+      else if (ls->t.token == TK_FLT) {
+        setfltvalue(v, -ls->t.seminfo.r);
+      }
+      else
+        solX_syntaxerror(ls, "number expected");
+      break;
+    }
+    case '{': {
+      datatable(ls);
+      return;
+    }
+    default:
+      solX_syntaxerror(ls, "unexpected symbol");
+  }
+  L->top.p++;
+  solX_next(ls);
+}
+
+
+/*
+** Parse a data chunk, leaving its value on the stack.
+*/
+void solY_data (sol_State *L, ZIO *z, Mbuffer *buff, const char *name,
+                int firstchar) {
+  LexState lexstate;
+  TString *source;
+  lexstate.h = solH_new(L);  /* create table for scanner */
+  sethvalue2s(L, L->top.p, lexstate.h);  /* anchor it */
+  solD_inctop(L);
+  source = solS_new(L, name);
+  setsvalue2s(L, L->top.p, source);  /* anchor it */
+  solD_inctop(L);
+  lexstate.buff = buff;
+  lexstate.dyd = NULL;
+  solX_setinput(L, &lexstate, z, source, firstchar);
+  solX_next(&lexstate);  /* read first token */
+  testnext(&lexstate, TK_RETURN);
+  solD_checkstack(L, 1);
+  datavalue(&lexstate);
+  testnext(&lexstate, ';');
+  check(&lexstate, TK_EOS);
+  setobjs2s(L, L->top.p - 3, L->top.p - 1);  /* move value down */
+  L->top.p -= 2;  /* remove scanner's table and source */
+}
+
+/* }====================================================================== */
@@ -166,6 +166,8 @@ typedef struct FuncState {
 SOLI_FUNC int solY_nvarstack (FuncState *fs);
 SOLI_FUNC LClosure *solY_parser (sol_State *L, ZIO *z, Mbuffer *buff,
                                  Dyndata *dyd, const char *name, int firstchar);
+SOLI_FUNC void solY_data (sol_State *L, ZIO *z, Mbuffer *buff,
+                          const char *name, int firstchar);
 
 
 #endif
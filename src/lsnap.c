@@ -0,0 +1,362 @@
+/*
+** $Id: lsnap.c $
+** Heap snapshots
+** See Copyright Notice in sol.h
+*/
+
+#define lsnap_c
+#define SOL_CORE
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sol.h"
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lsnap.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+
+
+/*
+** A snapshot is a stream of records, written while the object lists
+** are walked, so that its cost in memory does not depend on the size
+** of the heap:
+**
+** header: SOL_SNAPSIGNATURE, SNAP_FORMAT
+** roots: SNAP_ROOTS, edges
+** object: SNAP_OBJECT, variant tag (byte), id, size, label, edges
+** end: SNAP_END
+**
+** Ids are object addresses, sizes and lengths are written as in
+** precompiled chunks (see 'dumpSize'), a label is a length followed by
+** that many bytes, and edges are pairs (kind, id) ending with a zero
+** byte. Tools should ignore edges to ids without an object record.
+*/
+
+#define SNAPBUFFSIZE	4096
+
+
+typedef struct SnapState {
+  sol_State *L;
+  sol_Writer writer;
+  void *data;
+  int status;
+  TString *namekey;  /* "__name", to label tables and userdata */
+  size_t n;  /* number of bytes in 'buff' */
+  lu_byte buff[SNAPBUFFSIZE];
+} SnapState;
+
+
+static void flushsnap (SnapState *S) {
+  if (S->status == 0 && S->n > 0) {
+    sol_unlock(S->L);
+    S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+    sol_lock(S->L);
+  }
+  S->n = 0;
+}
+
+
+static void snapBlock (SnapState *S, const void *b, size_t size) {
+  if (S->n + size > SNAPBUFFSIZE) {
+    flushsnap(S);
+    if (size > SNAPBUFFSIZE) {  /* too large for the buffer? */
+      if (S->status == 0) {
+        sol_unlock(S->L);
+        S->status = (*S->writer)(S->L, b, size, S->data);
+        sol_lock(S->L);
+      }
+      return;
+    }
+  }
+  memcpy(S->buff + S->n, b, size);
+  S->n += size;
+}
+
+
+static void snapByte (SnapState *S, int y) {
+  lu_byte x = (lu_byte)y;
+  snapBlock(S, &x, 1);
+}
+
+
+/* see 'dumpSize' in 'ldump.c' */
+#define DIBS    ((sizeof(size_t) * CHAR_BIT + 6) / 7)
+
+static void snapSize (SnapState *S, size_t x) {
+  lu_byte buff[DIBS];
+  int n = 0;
+  do {
+    buff[DIBS - (++n)] = x & 0x7f;  /* fill buffer in reverse order */
+    x >>= 7;
+  } while (x != 0);
+  buff[DIBS - 1] |= 0x80;  /* mark last byte */
+  snapBlock(S, buff + DIBS - n, n);
+}
+
+
+static void snapLabel (SnapState *S, const char *s, size_t l) {
+  snapSize(S, l);
+  snapBlock(S, s, l);
+}
+
+
+#define snapId(S,o)	snapSize(S, cast_sizet(o))
+
+
+static void snapEdge (SnapState *S, int kind, const void *o) {
+  if (o != NULL) {  /* optional references can be absent */
+    snapByte(S, kind);
+    snapId(S, o);
+  }
+}
+
+
+#define snapValue(S,k,v)  \
+	{ if (iscollectable(v)) snapEdge(S, k, gcvalue(v)); }
+
+
+/*
+** Size of an object, including the parts it owns.
+*/
+static size_t objsize (GCObject *o) {
+  switch (o->tt) {
+    case SOL_VSHRSTR:
+      return sizelstring(gco2ts(o)->shrlen);
+    case SOL_VLNGSTR:
+      return sizelstring(gco2ts(o)->u.lnglen);
+    case SOL_VTABLE: {
+      Table *h = gco2t(o);
+      return sizeof(Table) + sizeof(TValue) * solH_realasize(h) +
+             sizeof(Node) * allocsizenode(h) + solH_numcards(h);
+    }
+    case SOL_VLCL:
+      return sizeLclosure(gco2lcl(o)->nupvalues);
+    case SOL_VCCL:
+      return sizeCclosure(gco2ccl(o)->nupvalues);
+    case SOL_VUSERDATA: {
+      Udata *u = gco2u(o);
+      return sizeudata(u->nuvalue, u->len);
+    }
+    case SOL_VTHREAD: {
+      sol_State *th = gco2th(o);
+      size_t sz = SOL_EXTRASPACE + sizeof(sol_State) +
+                  sizeof(CallInfo) * th->nci;
+      if (th->stack.p != NULL)
+        sz += sizeof(StackValue) * (stacksize(th) + EXTRA_STACK);
+      return sz;
+    }
+    case SOL_VPROTO: {
+      Proto *f = gco2p(o);
+      size_t sz = sizeof(Proto) +
+                  sizeof(Proto *) * f->sizep + sizeof(TValue) * f->sizek +
+                  sizeof(LocVar) * f->sizelocvars +
+                  sizeof(Upvaldesc) * f->sizeupvalues;
+      if (!isfixed(f))  /* vectors not in an external buffer? */
+        sz += sizeof(Instruction) * f->sizecode +
+              sizeof(ls_byte) * f->sizelineinfo +
+              sizeof(AbsLineInfo) * f->sizeabslineinfo;
+      return sz;
+    }
+    case SOL_VUPVAL:
+      return sizeof(UpVal);
+    default: sol_assert(0); return 0;
+  }
+}
+
+
+/* label of a function: its source and line where it was defined */
+static void protolabel (SnapState *S, const Proto *p) {
+  char buff[SOL_IDSIZE + 20];
+  if (p == NULL || p->source == NULL)
+    snapLabel(S, "?", 1);
+  else {
+    char src[SOL_IDSIZE];
+    size_t len;
+    solO_chunkid(src, getstr(p->source), tsslen(p->source));
+    len = strlen(src);
+    memcpy(buff, src, len);
+    l_sprintf(buff + len, sizeof(buff) - len, ":%d", p->linedefined);
+    snapLabel(S, buff, strlen(buff));
+  }
+}
+
+
+/* label of a table or userdata: the '__name' of its metatable, if any */
+static void mtlabel (SnapState *S, Table *mt) {
+  if (mt != NULL) {
+    const TValue *name = solH_getshortstr(mt, S->namekey);
+    if (name != NULL && ttisstring(name)) {
+      TString *ts = tsvalue(name);
+      snapLabel(S, getstr(ts), tsslen(ts));
+      return;
+    }
+  }
+  snapLabel(S, "", 0);
+}
+
+
+#define LABELMAX	40	/* bytes of a string kept as its label */
+
+static void snapobject (SnapState *S, GCObject *o) {
+  global_State *g = G(S->L);
+  snapByte(S, SNAP_OBJECT);
+  snapByte(S, o->tt);
+  snapId(S, o);
+  snapSize(S, objsize(o));
+  switch (o->tt) {
+    case SOL_VSHRSTR: case SOL_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      size_t l = tsslen(ts);
+      snapLabel(S, getstr(ts), (l > LABELMAX) ? LABELMAX : l);
+      break;
+    }
+    case SOL_VTABLE: {
+      Table *h = gco2t(o);
+      const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+      int wk = 0, wv = 0;
+      unsigned int i, asize = solH_realasize(h);
+      Node *n, *limit = gnode(h, cast_sizet(sizenode(h)));
+      if (mode && ttisshrstring(mode)) {
+        wk = (strchr(getshrstr(tsvalue(mode)), 'k') != NULL);
+        wv = (strchr(getshrstr(tsvalue(mode)), 'v') != NULL);
+      }
+      mtlabel(S, h->metatable);
+      snapEdge(S, SNAP_EMETA, h->metatable);
+      for (i = 0; i < asize; i++)
+        snapValue(S, wv ? SNAP_EWEAK : SNAP_EVALUE, &h->array[i]);
+      for (n = gnode(h, 0); n < limit; n++) {
+        if (!isempty(gval(n))) {
+          if (keyiscollectable(n))
+            snapEdge(S, wk ? SNAP_EWEAK : SNAP_EKEY, gckey(n));
+          snapValue(S, wv ? SNAP_EWEAK : SNAP_EVALUE, gval(n));
+        }
+      }
+      break;
+    }
+    case SOL_VUSERDATA: {
+      Udata *u = gco2u(o);
+      int i;
+      mtlabel(S, u->metatable);
+      snapEdge(S, SNAP_EMETA, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        snapValue(S, SNAP_EUSERVALUE, &u->uv[i].uv);
+      break;
+    }
+    case SOL_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      int i;
+      protolabel(S, cl->p);
+      snapEdge(S, SNAP_EPROTO, cl->p);
+      for (i = 0; i < cl->nupvalues; i++)
+        snapEdge(S, SNAP_EUPVALUE, cl->upvals[i]);
+      break;
+    }
+    case SOL_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      snapLabel(S, "", 0);
+      for (i = 0; i < cl->nupvalues; i++)
+        snapValue(S, SNAP_EUPVALUE, &cl->upvalue[i]);
+      break;
+    }
+    case SOL_VUPVAL: {
+      snapLabel(S, "", 0);
+      snapValue(S, SNAP_EVALUE, gco2upv(o)->v.p);
+      break;
+    }
+    case SOL_VPROTO: {
+      Proto *f = gco2p(o);
+      int i;
+      protolabel(S, f);
+      for (i = 0; i < f->sizek; i++)
+        snapValue(S, SNAP_EVALUE, &f->k[i]);
+      for (i = 0; i < f->sizep; i++)
+        snapEdge(S, SNAP_EPROTO, f->p[i]);
+      snapEdge(S, SNAP_EDEBUG, f->source);
+      for (i = 0; i < f->sizeupvalues; i++)
+        snapEdge(S, SNAP_EDEBUG, f->upvalues[i].name);
+      for (i = 0; i < f->sizelocvars; i++)
+        snapEdge(S, SNAP_EDEBUG, f->locvars[i].varname);
+      break;
+    }
+    case SOL_VTHREAD: {
+      sol_State *th = gco2th(o);
+      StkId s;
+      UpVal *uv;
+      snapLabel(S, "", 0);
+      if (th->stack.p != NULL) {
+        for (s = th->stack.p; s < th->top.p; s++)
+          snapValue(S, SNAP_ESTACK, s2v(s));
+      }
+      for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+        snapEdge(S, SNAP_EUPVALUE, uv);
+      break;
+    }
+    default: sol_assert(0);
+  }
+  snapByte(S, 0);  /* end of edges */
+}
+
+
+static void snaplist (SnapState *S, GCObject *o) {
+  for (; o != NULL && S->status == 0; o = o->next)
+    snapobject(S, o);
+}
+
+
+static void snaproots (SnapState *S) {
+  global_State *g = G(S->L);
+  GCObject *o;
+  int i;
+  snapByte(S, SNAP_ROOTS);
+  snapEdge(S, SNAP_EVALUE, gcvalue(&g->l_registry));
+  snapEdge(S, SNAP_ESTACK, g->mainthread);
+  snapEdge(S, SNAP_ESTACK, S->L);
+  for (i = 0; i < SOL_NUMTAGS; i++)
+    snapEdge(S, SNAP_EMETA, g->mt[i]);
+  for (o = g->tobefnz; o != NULL; o = o->next)  /* being finalized */
+    snapEdge(S, SNAP_EVALUE, o);
+  snapByte(S, 0);  /* end of edges */
+}
+
+
+/*
+** Write a snapshot of all objects in the state. An unfinished sweep
+** is completed first, as lists being swept can hold dead objects that
+** refer to objects already freed. Writing does not allocate, so the
+** collector cannot run while lists are being walked. (For the same
+** reason, the writer must not call the API.)
+*/
+int solC_snapshot (sol_State *L, sol_Writer w, void *data) {
+  global_State *g = G(L);
+  SnapState S;
+  if (issweepphase(g))
+    solC_runtilstate(L, bitmask(GCScallfin));
+  S.namekey = solS_newliteral(L, "__name");  /* last allocation */
+  S.L = L;
+  S.writer = w;
+  S.data = data;
+  S.status = 0;
+  S.n = 0;
+  snapBlock(&S, SOL_SNAPSIGNATURE, sizeof(SOL_SNAPSIGNATURE) - 1);
+  snapByte(&S, SNAP_FORMAT);
+  snaproots(&S);
+  snaplist(&S, g->allgc);
+  snaplist(&S, g->finobj);
+  snaplist(&S, g->tobefnz);
+  snaplist(&S, g->fixedgc);
+  snapByte(&S, SNAP_END);
+  flushsnap(&S);
+  return S.status;
+}
+
@@ -0,0 +1,38 @@
+/*
+** $Id: lsnap.h $
+** Heap snapshots
+** See Copyright Notice in sol.h
+*/
+
+#ifndef lsnap_h
+#define lsnap_h
+
+#include "llimits.h"
+#include "lstate.h"
+
+
+/* mark for heap snapshots ('<esc>SolHeap') */
+#define SOL_SNAPSIGNATURE	"\x1bSolHeap"
+
+#define SNAP_FORMAT	1
+
+/* record tags */
+#define SNAP_END	0
+#define SNAP_ROOTS	1
+#define SNAP_OBJECT	2
+
+/* edge kinds */
+#define SNAP_EVALUE	'v'	/* field value, constant, upvalue content */
+#define SNAP_EKEY	'k'	/* table key */
+#define SNAP_EWEAK	'w'	/* weak key or value (does not retain) */
+#define SNAP_EMETA	'm'	/* metatable */
+#define SNAP_EUSERVALUE	'u'	/* userdata user value */
+#define SNAP_EUPVALUE	'U'	/* closure upvalue */
+#define SNAP_EPROTO	'p'	/* function prototype */
+#define SNAP_EDEBUG	'd'	/* debug information (names, source) */
+#define SNAP_ESTACK	's'	/* thread stack slot */
+
+/* write a snapshot of the whole heap; from lsnap.c */
+SOLI_FUNC int solC_snapshot (sol_State *L, sol_Writer w, void *data);
+
+#endif
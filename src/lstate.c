@@ -103,54 +103,59 @@ SOL_API int sol_setcstacklimit (sol_State *L, unsigned int limit) {
 
 
 CallInfo *solE_extendCI (sol_State *L) {
-  CallInfo *ci;
+  CIChunk *c;
+  int i;
   sol_assert(L->ci->next == NULL);
-  ci = solM_new(L, CallInfo);
+  c = solM_new(L, CIChunk);
   sol_assert(L->ci->next == NULL);
-  L->ci->next = ci;
-  ci->previous = L->ci;
-  ci->next = NULL;
-  ci->u.l.trap = 0;
-  L->nci++;
-  return ci;
+  for (i = 0; i < SOLI_CICHUNK; i++) {  /* link the new CallInfos */
+    CallInfo *ci = &c->ci[i];
+    ci->previous = (i == 0) ? L->ci : ci - 1;
+    ci->next = (i + 1 < SOLI_CICHUNK) ? ci + 1 : NULL;
+    ci->u.l.trap = 0;
+  }
+  L->ci->next = &c->ci[0];
+  c->previous = L->cichunk;
+  L->cichunk = c;
+  L->nci += SOLI_CICHUNK;
+  G(L)->gcstats.ncichunks++;
+  return &c->ci[0];
 }
 
 
 /*
-** free all CallInfo structures not in use by a thread
+** free all CallInfo structures of a thread (which must not be in use)
 */
 static void freeCI (sol_State *L) {
-  CallInfo *ci = L->ci;
-  CallInfo *next = ci->next;
-  ci->next = NULL;
-  while ((ci = next) != NULL) {
-    next = ci->next;
-    solM_free(L, ci);
-    L->nci--;
+  CIChunk *c = L->cichunk;
+  sol_assert(L->ci == &L->base_ci);
+  L->base_ci.next = NULL;
+  while (c != NULL) {
+    CIChunk *previous = c->previous;
+    solM_free(L, c);
+    L->nci -= SOLI_CICHUNK;
+    c = previous;
   }
+  L->cichunk = NULL;
 }
 
 
 /*
-** free half of the CallInfo structures not in use by a thread,
-** keeping the first one.
+** free chunks at the end of the CallInfo list that are not in use,
+** keeping at least as many free CallInfo structures as there are in use
+** (and at least one chunk).
 */
 void solE_shrinkCI (sol_State *L) {
-  CallInfo *ci = L->ci->next;  /* first free CallInfo */
-  CallInfo *next;
-  if (ci == NULL)
-    return;  /* no extra elements */
-  while ((next = ci->next) != NULL) {  /* two extra elements? */
-    CallInfo *next2 = next->next;  /* next's next */
-    ci->next = next2;  /* remove next from the list */
-    L->nci--;
-    solM_free(L, next);  /* free next */
-    if (next2 == NULL)
-      break;  /* no more elements */
-    else {
-      next2->previous = ci;
-      ci = next2;  /* continue */
-    }
+  CallInfo *ci;
+  int keep = SOLI_CICHUNK;
+  for (ci = L->ci; ci != &L->base_ci; ci = ci->previous)
+    keep += 2;  /* count the CallInfo and one free for it */
+  while (L->nci - SOLI_CICHUNK >= keep) {  /* last chunk not needed? */
+    CIChunk *c = L->cichunk;
+    c->ci[0].previous->next = NULL;  /* unlink it */
+    L->cichunk = c->previous;
+    L->nci -= SOLI_CICHUNK;
+    solM_free(L, c);
   }
 }
 
@@ -247,10 +252,13 @@ static void f_solopen (sol_State *L, void *ud) {
 ** any memory (to avoid errors)
 */
 static void preinit_thread (sol_State *L, global_State *g) {
+  int i;
   G(L) = g;
   L->stack.p = NULL;
   L->ci = NULL;
   L->nci = 0;
+  L->cichunk = NULL;
+  L->stackidle = 0;
   L->twups = L;  /* thread has no upvalues */
   L->nCcalls = 0;
   L->errorJmp = NULL;
@@ -260,12 +268,78 @@ static void preinit_thread (sol_State *L, global_State *g) {
   L->allowhook = 1;
   resethookcount(L);
   L->openupval = NULL;
+  for (i = 0; i < SOLI_UPVALCACHE; i++)
+    L->upvalcache[i] = NULL;
   L->status = SOL_OK;
   L->errfunc = 0;
+  L->nCresume = 0;
   L->oldpc = 0;
 }
 
 
+/*
+** Prepare a pooled thread to run again: the stack is cleaned (it may
+** refer to dead objects) and the CallInfo list is kept.
+*/
+static void stack_reset (sol_State *L1) {
+  CallInfo *ci = &L1->base_ci;
+  StkId s;
+  for (s = L1->stack.p; s < L1->stack_last.p + EXTRA_STACK; s++)
+    setnilvalue(s2v(s));  /* erase old stack */
+  L1->tbclist.p = L1->stack.p;
+  L1->top.p = L1->stack.p;
+  ci->previous = NULL;
+  ci->callstatus = CIST_C;
+  ci->func.p = L1->top.p;
+  ci->u.c.k = NULL;
+  ci->nresults = 0;
+  L1->top.p++;  /* 'function' entry for this 'ci' (already nil) */
+  ci->top.p = L1->top.p + SOL_MINSTACK;
+  L1->ci = ci;
+}
+
+
+/*
+** Take a thread from the pool and link it back as a new object.
+*/
+static sol_State *reusethread (global_State *g) {
+  GCObject *o = g->threadpool;
+  sol_State *L1 = gco2th(o);
+  StkIdRel stack = L1->stack;
+  StkIdRel stack_last = L1->stack_last;
+  CallInfo *ci = L1->base_ci.next;
+  CIChunk *cichunk = L1->cichunk;
+  int nci = L1->nci;
+  g->threadpool = o->next;
+  g->npooled--;
+  o->marked = solC_white(g);
+  o->next = g->allgc;
+  g->allgc = o;
+  preinit_thread(L1, g);
+  L1->stack = stack;
+  L1->stack_last = stack_last;
+  L1->base_ci.next = ci;
+  L1->cichunk = cichunk;
+  L1->nci = nci;
+  stack_reset(L1);
+  return L1;
+}
+
+
+/*
+** Call the functions registered by 'sol_atclose', last registered first.
+*/
+static void callclosefuncs (sol_State *L) {
+  global_State *g = G(L);
+  while (g->closefuncs != NULL) {
+    CloseFunc *c = g->closefuncs;
+    g->closefuncs = c->next;
+    (*c->f)(closeblock(c));
+    solM_freemem(L, c, sizeof(CloseFunc) + c->size);
+  }
+}
+
+
 static void close_state (sol_State *L) {
   global_State *g = G(L);
   if (!completestate(g))  /* closing a partially built state? */
@@ -278,6 +352,8 @@ static void close_state (sol_State *L) {
     solC_freeallobjects(L);  /* collect all objects */
     soli_userstateclose(L);
   }
+  callclosefuncs(L);
+  solE_clearthreadpool(L);
   solM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
   freestack(L);
   sol_assert(gettotalbytes(g) == sizeof(LG));
@@ -291,13 +367,20 @@ SOL_API sol_State *sol_newthread (sol_State *L) {
   sol_State *L1;
   sol_lock(L);
   solC_checkGC(L);
-  /* create new thread */
-  o = solC_newobjdt(L, SOL_TTHREAD, sizeof(LX), offsetof(LX, l));
-  L1 = gco2th(o);
-  /* anchor it on L stack */
-  setthvalue2s(L, L->top.p, L1);
-  api_incr_top(L);
-  preinit_thread(L1, g);
+  if (g->threadpool != NULL) {  /* is there a dead thread to reuse? */
+    L1 = reusethread(g);
+    setthvalue2s(L, L->top.p, L1);
+    api_incr_top(L);
+    solM_sample(L, fromstate(L1), SOL_TTHREAD, sizeof(LX));
+  }
+  else {  /* create new thread */
+    o = solC_newobjdt(L, SOL_TTHREAD, sizeof(LX), offsetof(LX, l));
+    L1 = gco2th(o);
+    /* anchor it on L stack */
+    setthvalue2s(L, L->top.p, L1);
+    api_incr_top(L);
+    preinit_thread(L1, g);
+  }
   L1->hookmask = L->hookmask;
   L1->basehookcount = L->basehookcount;
   L1->hook = L->hook;
@@ -306,22 +389,53 @@ SOL_API sol_State *sol_newthread (sol_State *L) {
   memcpy(sol_getextraspace(L1), sol_getextraspace(g->mainthread),
          SOL_EXTRASPACE);
   soli_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  if (L1->stack.p == NULL)  /* not reused? */
+    stack_init(L1, L);  /* init stack */
   sol_unlock(L);
   return L1;
 }
 
 
+/*
+** Threads are not pooled while the state is being closed or during
+** emergency collections, which must give memory back.
+*/
+#define canpool(g,L1)  \
+	((g)->npooled < SOLI_MAXPOOL && !(g)->gcemergency && \
+	 !((g)->gcstp & GCSTPCLS) && (L1)->stack.p != NULL && \
+	 stacksize(L1) <= SOLI_POOLSTACK)
+
+
 void solE_freethread (sol_State *L, sol_State *L1) {
+  global_State *g = G(L);
   LX *l = fromstate(L1);
   solF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   sol_assert(L1->openupval == NULL);
   soli_userstatefree(L, L1);
+  if (canpool(g, L1)) {  /* keep it for 'sol_newthread' */
+    solM_samplefree(L, l);  /* it is not live anymore */
+    obj2gco(L1)->next = g->threadpool;
+    g->threadpool = obj2gco(L1);
+    g->npooled++;
+    return;
+  }
   freestack(L1);
   solM_free(L, l);
 }
 
 
+void solE_clearthreadpool (sol_State *L) {
+  global_State *g = G(L);
+  while (g->threadpool != NULL) {
+    sol_State *L1 = gco2th(g->threadpool);
+    g->threadpool = g->threadpool->next;
+    freestack(L1);
+    solM_free(L, fromstate(L1));
+  }
+  g->npooled = 0;
+}
+
+
 int solE_resetthread (sol_State *L, int status) {
   CallInfo *ci = L->ci = &L->base_ci;  /* unwind CallInfo list */
   setnilvalue(s2v(L->stack.p));  /* 'function' entry for basic 'ci' */
@@ -400,6 +514,21 @@ SOL_API sol_State *sol_newstate (sol_Alloc f, void *ud) {
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->lastatomic = 0;
+  g->gcclock = 0;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->samplef = NULL;
+  g->ud_sample = NULL;
+  g->sampleinterval = g->samplecount = 0;
+  g->gcadapt = 0;
+  g->gcdeferfin = 0;
+  g->releasef = NULL;
+  g->ud_release = NULL;
+  g->gcpeak = 0;
+  g->memlimit = 0;
+  g->threadpool = NULL;
+  g->npooled = 0;
+  g->nextf = g->inextf = NULL;
+  g->closefuncs = NULL;
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g->gcpause, SOLI_GCPAUSE);
   setgcparam(g->gcstepmul, SOLI_GCMUL);
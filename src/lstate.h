@@ -147,6 +147,41 @@ struct sol_longjmp;  /* defined in ldo.c */
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
 
 
+/*
+** Dead threads are kept in a pool, with their stacks and CallInfo
+** lists, to be reused by 'sol_newthread'; only threads whose stacks
+** did not grow beyond SOLI_POOLSTACK slots go to the pool.
+*/
+#if !defined(SOLI_MAXPOOL)
+#define SOLI_MAXPOOL	32
+#endif
+
+#if !defined(SOLI_POOLSTACK)
+#define SOLI_POOLSTACK	(8*BASIC_STACK_SIZE)
+#endif
+
+
+/*
+** Size of the direct-mapped cache of open upvalues, indexed by stack
+** slot, that spares 'solF_findupval' the walk through 'openupval' (see
+** 'lfunc.c'). Must be a power of 2.
+*/
+#if !defined(SOLI_UPVALCACHE)
+#define SOLI_UPVALCACHE	8
+#endif
+
+
+/*
+** A stack (and its CallInfo list) larger than needed is only shrunk
+** after it was found oversized by SOLI_SHRINKDELAY collections in a
+** row, so that threads alternating deep and shallow recursions do not
+** reallocate their stacks at every cycle (see 'solD_shrinkstack').
+*/
+#if !defined(SOLI_SHRINKDELAY)
+#define SOLI_SHRINKDELAY	4
+#endif
+
+
 /* kinds of Garbage Collection */
 #define KGC_INC		0	/* incremental gc */
 #define KGC_GEN		1	/* generational gc */
@@ -204,6 +239,21 @@ struct CallInfo {
 };
 
 
+/*
+** CallInfo structures are allocated SOLI_CICHUNK at a time. The chunks
+** of a thread follow each other in its CallInfo list, in the order they
+** were allocated; 'cichunk' points to the last one.
+*/
+#if !defined(SOLI_CICHUNK)
+#define SOLI_CICHUNK	16
+#endif
+
+typedef struct CIChunk {
+  struct CIChunk *previous;  /* chunk before this one in the list */
+  CallInfo ci[SOLI_CICHUNK];
+} CIChunk;
+
+
 /*
 ** Bits in CallInfo status
 */
@@ -222,6 +272,7 @@ struct CallInfo {
 #if defined(SOL_COMPAT_LT_LE)
 #define CIST_LEQ	(1<<13)  /* using __lt for __le */
 #endif
+#define CIST_TM		(1<<14)  /* metamethod pushed by the VM (see ltm.c) */
 
 
 /*
@@ -248,6 +299,22 @@ struct CallInfo {
 #define getoah(st)	((st) & CIST_OAH)
 
 
+/*
+** Measures for the adaptive choice of a collector mode (see function
+** 'adaptmode' in file 'lgc.c')
+*/
+typedef struct GCAdapt {
+  double cost[2];  /* GC time per Kbyte allocated, by mode (0 if unknown) */
+  double wtime;  /* total pause time at the start of current window */
+  lu_mem walloc;  /* bytes allocated in current window */
+  lu_mem live;  /* bytes in use at the end of last collection */
+  lu_mem swept;  /* bytes swept until the end of last collection */
+  int survival;  /* average percentage of allocated bytes surviving */
+  int ncycles;  /* collections in current window */
+  int window;  /* collections between two decisions */
+} GCAdapt;
+
+
 /*
 ** 'global state', shared by all threads of this state
 */
@@ -269,6 +336,8 @@ typedef struct global_State {
   lu_byte genminormul;  /* control for minor generational collections */
   lu_byte genmajormul;  /* control for major generational collections */
   lu_byte gcstp;  /* control whether GC is running */
+  lu_byte gcadapt;  /* true if collector chooses its own mode */
+  lu_byte gcdeferfin;  /* true if finalizers only run when asked to */
   lu_byte gcemergency;  /* true if this is an emergency collection */
   lu_byte gcpause;  /* size of pause between successive GCs */
   lu_byte gcstepmul;  /* GC "speed" */
@@ -300,9 +369,39 @@ typedef struct global_State {
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   sol_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  double gcclock;  /* start of current accounting interval (see 'lgc.c') */
+  sol_GCStats gcstats;  /* collector statistics */
+  sol_SampleFunction samplef;  /* allocation sampler (or NULL) */
+  void *ud_sample;  /* auxiliary data to 'samplef' */
+  l_mem sampleinterval;  /* bytes between two samples */
+  l_mem samplecount;  /* bytes left until next sample */
+  GCAdapt adapt;  /* measures for the adaptive mode */
+  sol_ReleaseFunction releasef;  /* gives memory back to the system */
+  void *ud_release;  /* auxiliary data to 'releasef' */
+  lu_mem gcpeak;  /* largest heap seen since last release */
+  lu_mem memlimit;  /* maximum size of the heap (0 means no limit) */
+  GCObject *threadpool;  /* dead threads ready to be reused */
+  int npooled;  /* number of threads in 'threadpool' */
+  sol_CFunction nextf;  /* 'next' run in-line by generic for loops */
+  sol_CFunction inextf;  /* 'ipairs' iterator run in-line by the VM */
+  struct CloseFunc *closefuncs;  /* functions to call when closing */
 } global_State;
 
 
+/*
+** A function to be called when the state is closed (see 'sol_atclose'),
+** followed by its block.
+*/
+typedef struct CloseFunc {
+  struct CloseFunc *next;
+  sol_CloseFunction f;
+  size_t size;  /* size of the block */
+  union {SOLI_MAXALIGN;} bindata;  /* ensures alignment for the block */
+} CloseFunc;
+
+#define closeblock(c)	(cast_charp(c) + sizeof(CloseFunc))
+
+
 /*
 ** 'per thread' state
 */
@@ -310,21 +409,25 @@ struct sol_State {
   CommonHeader;
   lu_byte status;
   lu_byte allowhook;
-  unsigned short nci;  /* number of items in 'ci' list */
+  lu_byte stackidle;  /* collections that found the stack oversized */
+  int nci;  /* number of items in 'ci' list */
   StkIdRel top;  /* first free slot in the stack */
   global_State *l_G;
   CallInfo *ci;  /* call info for current function */
   StkIdRel stack_last;  /* end of stack (last element + 1) */
   StkIdRel stack;  /* stack base */
   UpVal *openupval;  /* list of open upvalues in this stack */
+  UpVal *upvalcache[SOLI_UPVALCACHE];  /* recently used open upvalues */
   StkIdRel tbclist;  /* list of to-be-closed variables */
   GCObject *gclist;
   struct sol_State *twups;  /* list of threads with open upvalues */
   struct sol_longjmp *errorJmp;  /* current error recover point */
   CallInfo base_ci;  /* CallInfo for first level (C calling Sol) */
+  CIChunk *cichunk;  /* last chunk of the 'ci' list */
   volatile sol_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
   l_uint32 nCcalls;  /* number of nested (non-yieldable | C)  calls */
+  l_uint32 nCresume;  /* value of 'nCcalls' when thread was resumed */
   int oldpc;  /* last pc traced */
   int basehookcount;
   int hookcount;
@@ -395,6 +498,7 @@ union GCUnion {
 
 SOLI_FUNC void solE_setdebt (global_State *g, l_mem debt);
 SOLI_FUNC void solE_freethread (sol_State *L, sol_State *L1);
+SOLI_FUNC void solE_clearthreadpool (sol_State *L);
 SOLI_FUNC CallInfo *solE_extendCI (sol_State *L);
 SOLI_FUNC void solE_shrinkCI (sol_State *L);
 SOLI_FUNC void solE_checkcstack (sol_State *L);
@@ -25,6 +25,7 @@
 
 #include <math.h>
 #include <limits.h>
+#include <string.h>
 
 #include "sol.h"
 
@@ -326,10 +327,11 @@ static unsigned int arrayindex (sol_Integer k) {
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** beginning of a traversal is signaled by 0. Returns ~0u if 'key' is
+** not in the table.
 */
-static unsigned int findindex (sol_State *L, Table *t, TValue *key,
-                               unsigned int asize) {
+static unsigned int keyindex (Table *t, const TValue *key,
+                              unsigned int asize) {
   unsigned int i;
   if (ttisnil(key)) return 0;  /* first iteration */
   i = ttisinteger(key) ? arrayindex(ivalue(key)) : 0;
@@ -338,7 +340,7 @@ static unsigned int findindex (sol_State *L, Table *t, TValue *key,
   else {
     const TValue *n = getgeneric(t, key, 1);
     if (l_unlikely(isabstkey(n)))
-      solG_runerror(L, "invalid key to 'next'");  /* key not found */
+      return ~0u;  /* key not found */
     i = cast_int(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
@@ -346,14 +348,27 @@ static unsigned int findindex (sol_State *L, Table *t, TValue *key,
 }
 
 
-int solH_next (sol_State *L, Table *t, StkId key) {
-  unsigned int asize = solH_realasize(t);
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
+static unsigned int findindex (sol_State *L, Table *t, TValue *key,
+                               unsigned int asize) {
+  unsigned int i = keyindex(t, key, asize);
+  if (l_unlikely(i == ~0u))
+    solG_runerror(L, "invalid key to 'next'");  /* key not found */
+  return i;
+}
+
+
+/*
+** Stores in 'key'/'key + 1' the first non-empty entry at or after
+** traversal index 'i' and returns the index following it, or returns
+** 0 if there are no more entries.
+*/
+static unsigned int nextfrom (sol_State *L, Table *t, StkId key,
+                              unsigned int i, unsigned int asize) {
   for (; i < asize; i++) {  /* try first array part */
     if (!isempty(&t->array[i])) {  /* a non-empty entry? */
       setivalue(s2v(key), i + 1);
       setobj2s(L, key + 1, &t->array[i]);
-      return 1;
+      return i + 1;
     }
   }
   for (i -= asize; cast_int(i) < sizenode(t); i++) {  /* hash part */
@@ -361,16 +376,115 @@ int solH_next (sol_State *L, Table *t, StkId key) {
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
-      return 1;
+      return (i + 1) + asize;
     }
   }
   return 0;  /* no more elements */
 }
 
 
-static void freehash (sol_State *L, Table *t) {
+int solH_next (sol_State *L, Table *t, StkId key) {
+  unsigned int asize = solH_realasize(t);
+  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
+  return (nextfrom(L, t, key, i, asize) != 0);
+}
+
+
+/*
+** Variant of 'solH_next' for the VM's 'pairs' loops. '*cursor' is the
+** traversal index returned by the previous call; when it still matches
+** 'key', the key lookup is skipped. Returns -1 (and leaves the stack
+** untouched) if 'key' is not in the table, so that the caller can
+** report the error through the ordinary 'next'.
+*/
+int solH_nextcursor (sol_State *L, Table *t, StkId key,
+                     unsigned int *cursor) {
+  unsigned int asize = solH_realasize(t);
+  unsigned int i = *cursor;
+  const TValue *k = s2v(key);
+  if (ttisnil(k))
+    i = 0;
+  else if (i - 1u < asize ? !(ttisinteger(k) && l_castS2U(ivalue(k)) == i)
+                          : (i - 1u - asize >= cast_uint(sizenode(t)) ||
+                             !equalkey(k, gnode(t, i - 1u - asize), 1))) {
+    i = keyindex(t, k, asize);  /* stale cursor; look the key up */
+    if (l_unlikely(i == ~0u))
+      return -1;
+  }
+  *cursor = nextfrom(L, t, key, i, asize);
+  return (*cursor != 0);
+}
+
+
+/*
+** {=============================================================
+** Card tables
+** ==============================================================
+*/
+
+/* number of cards for a table with the given sizes (0 if it is small) */
+static unsigned int cardsfor (unsigned int asize, unsigned int nsize) {
+  if (cast(lu_mem, asize) + nsize < SOLI_MINCARDED)
+    return 0;
+  return numcards(nsize) + numcards(asize);
+}
+
+
+unsigned int solH_numcards (const Table *t) {
+  if (!hascards(t))
+    return 0;
+  return numcards(sizenode(t)) + numcards(solH_realasize(t));
+}
+
+
+/* card covering 'slot', which must be in the hash or the array part */
+unsigned int solH_cardof (const Table *t, const TValue *slot) {
+  const Node *n = cast(const Node *, slot);
+  if (t->node <= n && n < t->node + sizenode(t))
+    return cast_uint(n - t->node) >> SOLI_CARDBITS;
+  else {
+    sol_assert(t->array <= slot && slot < t->array + solH_realasize(t));
+    return numcards(sizenode(t)) +
+           (cast_uint(slot - t->array) >> SOLI_CARDBITS);
+  }
+}
+
+
+/*
+** Entries move when a table is resized, so all cards of the new card
+** table must remember what any card of the old one could: that is
+** what the age of the table tells (see 'solC_barriercard_').
+*/
+static int cardfill (Table *t) {
+  switch (getage(t)) {
+    case G_TOUCHED1: return CARD_TOUCHED1;
+    case G_TOUCHED2: return CARD_TOUCHED2;
+    default: return CARD_CLEAN;
+  }
+}
+
+
+/*
+** A colliding node that moves from 'from' to 'to' may refer to young
+** objects, so the card of 'to' must remember what the card of 'from'
+** does.
+*/
+static void movecard (Table *t, Node *from, Node *to) {
+  if (hascards(t)) {
+    lu_byte *cards = getcards(t);
+    unsigned int cfrom = solH_cardof(t, gval(from));
+    unsigned int cto = solH_cardof(t, gval(to));
+    if (cards[cto] < cards[cfrom])
+      cards[cto] = cards[cfrom];
+  }
+}
+
+/* }============================================================= */
+
+
+static void freehash (sol_State *L, Table *t, unsigned int ncards) {
   if (!isdummy(t))
-    solM_freearray(L, t->node, cast_sizet(sizenode(t)));
+    solM_freemem(L, t->node, cast_sizet(sizenode(t)) * sizeof(Node) + ncards);
 }
 
 
@@ -472,24 +586,28 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
 
 /*
 ** Creates an array for the hash part of a table with the given
-** size, or reuses the dummy node if size is zero.
+** size, or reuses the dummy node if size is zero. If the table, with
+** an array part of size 'asize', is large, its card table goes after
+** the nodes (and so it cannot use the dummy node).
 ** The computation for size overflow is in two steps: the first
 ** comparison ensures that the shift in the second one does not
 ** overflow.
 */
-static void setnodevector (sol_State *L, Table *t, unsigned int size) {
-  if (size == 0) {  /* no elements to hash part? */
+static void setnodevector (sol_State *L, Table *t, unsigned int size,
+                                                   unsigned int asize) {
+  if (size == 0 && cardsfor(asize, 1) == 0) {  /* no hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
     t->lsizenode = 0;
     t->lastfree = NULL;  /* signal that it is using dummy node */
   }
   else {
     int i;
-    int lsize = solO_ceillog2(size);
+    int lsize = (size == 0) ? 0 : solO_ceillog2(size);
     if (lsize > MAXHBITS || (1u << lsize) > MAXHSIZE)
       solG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = solM_newvector(L, size, Node);
+    t->node = cast(Node *, solM_malloc_(L, size * sizeof(Node) +
+                                           cardsfor(asize, size), 0));
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -548,16 +666,20 @@ static void exchangehashpart (Table *t1, Table *t2) {
 ** raises the allocation error. Otherwise, it sets the new hash part
 ** into the table, initializes the new part of the array (if any) with
 ** nils and reinserts the elements of the old hash back into the new
-** parts of the table.
+** parts of the table. (A card table, if the new sizes need one, comes
+** with the new hash part.)
 */
 void solH_resize (sol_State *L, Table *t, unsigned int newasize,
                                           unsigned int nhsize) {
   unsigned int i;
   Table newt;  /* to keep the new hash part */
   unsigned int oldasize = setlimittosize(t);
+  unsigned int oldncards = solH_numcards(t);
+  unsigned int ncards;
   TValue *newarray;
   /* create new hash part with appropriate size into 'newt' */
-  setnodevector(L, &newt, nhsize);
+  setnodevector(L, &newt, nhsize, newasize);
+  ncards = isdummy(&newt) ? 0 : cardsfor(newasize, sizenode(&newt));
   if (newasize < oldasize) {  /* will array shrink? */
     t->alimit = newasize;  /* pretend array has new size... */
     exchangehashpart(t, &newt);  /* and new hash */
@@ -572,7 +694,7 @@ void solH_resize (sol_State *L, Table *t, unsigned int newasize,
   /* allocate new array */
   newarray = solM_reallocvector(L, t->array, oldasize, newasize, TValue);
   if (l_unlikely(newarray == NULL && newasize > 0)) {  /* allocation failed? */
-    freehash(L, &newt);  /* release new hash part */
+    freehash(L, &newt, ncards);  /* release new hash part */
     solM_error(L);  /* raise error (with array unchanged) */
   }
   /* allocation ok; initialize new part of the array */
@@ -581,9 +703,15 @@ void solH_resize (sol_State *L, Table *t, unsigned int newasize,
   t->alimit = newasize;
   for (i = oldasize; i < newasize; i++)  /* clear new slice of the array */
      setempty(&t->array[i]);
+  if (ncards > 0) {
+    t->flags |= BITCARDS;
+    memset(getcards(t), cardfill(t), ncards);
+  }
+  else
+    t->flags &= cast_byte(~BITCARDS);
   /* re-insert elements from old hash part into new parts */
   reinsert(L, &newt, t);  /* 'newt' now has the old hash */
-  freehash(L, &newt);  /* free old hash part */
+  freehash(L, &newt, oldncards);  /* free old hash part */
 }
 
 
@@ -630,13 +758,13 @@ Table *solH_new (sol_State *L) {
   t->flags = cast_byte(maskflags);  /* table has no metamethod fields */
   t->array = NULL;
   t->alimit = 0;
-  setnodevector(L, t, 0);
+  setnodevector(L, t, 0, 0);
   return t;
 }
 
 
 void solH_free (sol_State *L, Table *t) {
-  freehash(L, t);
+  freehash(L, t, solH_numcards(t));
   solM_freearray(L, t->array, solH_realasize(t));
   solM_free(L, t);
 }
@@ -698,6 +826,7 @@ static void solH_newkey (sol_State *L, Table *t, const TValue *key,
         othern += gnext(othern);
       gnext(othern) = cast_int(f - othern);  /* rechain to point to 'f' */
       *f = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
+      movecard(t, mp, f);
       if (gnext(mp) != 0) {
         gnext(f) += cast_int(mp - f);  /* correct 'next' */
         gnext(mp) = 0;  /* now 'mp' is free */
@@ -714,7 +843,7 @@ static void solH_newkey (sol_State *L, Table *t, const TValue *key,
     }
   }
   setnodekey(L, mp, key);
-  solC_barrierback(L, obj2gco(t), key);
+  solC_barrierslot(L, t, gval(mp), key);
   sol_assert(isempty(gval(mp)));
   setobj2t(L, gval(mp), value);
 }
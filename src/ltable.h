@@ -35,6 +35,35 @@
 #define nodefromval(v)	cast(Node *, (v))
 
 
+/*
+** Large tables have a card table, with one byte for each group of
+** CARDSIZE slots (first the hash part, then the array part), so that
+** young collections only retraverse the groups written since the table
+** became old (see 'solC_barriercard_'). It is allocated with the hash
+** part, right after its nodes, so large tables never use the dummy node.
+*/
+#if !defined(SOLI_CARDBITS)
+#define SOLI_CARDBITS	7
+#endif
+
+/* minimum number of slots for a table to have a card table */
+#if !defined(SOLI_MINCARDED)
+#define SOLI_MINCARDED	(1u << 12)
+#endif
+
+#define CARDSIZE	(1u << SOLI_CARDBITS)
+
+/* number of cards to cover 'n' slots */
+#define numcards(n)	(((n) + CARDSIZE - 1) >> SOLI_CARDBITS)
+
+#define getcards(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* card states; traversals age a card by decrementing it */
+#define CARD_CLEAN	0
+#define CARD_TOUCHED2	1	/* written in the previous cycle */
+#define CARD_TOUCHED1	2	/* written in the current cycle */
+
+
 SOLI_FUNC const TValue *solH_getint (Table *t, sol_Integer key);
 SOLI_FUNC void solH_setint (sol_State *L, Table *t, sol_Integer key,
                                                     TValue *value);
@@ -51,8 +80,12 @@ SOLI_FUNC void solH_resize (sol_State *L, Table *t, unsigned int nasize,
 SOLI_FUNC void solH_resizearray (sol_State *L, Table *t, unsigned int nasize);
 SOLI_FUNC void solH_free (sol_State *L, Table *t);
 SOLI_FUNC int solH_next (sol_State *L, Table *t, StkId key);
+SOLI_FUNC int solH_nextcursor (sol_State *L, Table *t, StkId key,
+                                unsigned int *cursor);
 SOLI_FUNC sol_Unsigned solH_getn (Table *t);
 SOLI_FUNC unsigned int solH_realasize (const Table *t);
+SOLI_FUNC unsigned int solH_numcards (const Table *t);
+SOLI_FUNC unsigned int solH_cardof (const Table *t, const TValue *slot);
 
 
 #if defined(SOL_DEBUG)
@@ -134,6 +134,32 @@ void solT_callTMres (sol_State *L, const TValue *f, const TValue *p1,
 }
 
 
+/*
+** Push a call to the Sol function 'f' (a metamethod) as a new frame,
+** without running it: the VM runs it in its own loop and, when it
+** returns, finishes the instruction that called it with
+** 'solV_finishOp', as it does after a yield. So, these calls do not
+** use the C stack. 'p3' is NULL for metamethods with two arguments.
+*/
+CallInfo *solT_pushTM (sol_State *L, const TValue *f, const TValue *p1,
+                       const TValue *p2, const TValue *p3, int nresults) {
+  StkId func = L->top.p;
+  CallInfo *ci;
+  setobj2s(L, func, f);  /* push function (assume EXTRA_STACK) */
+  setobj2s(L, func + 1, p1);  /* 1st argument */
+  setobj2s(L, func + 2, p2);  /* 2nd argument */
+  L->top.p = func + 3;
+  if (p3 != NULL) {
+    setobj2s(L, func + 3, p3);  /* 3rd argument */
+    L->top.p++;
+  }
+  ci = solD_precall(L, func, nresults);
+  sol_assert(ci != NULL);  /* 'f' must be a Sol function */
+  ci->callstatus |= CIST_TM;
+  return ci;
+}
+
+
 static int callbinTM (sol_State *L, const TValue *p1, const TValue *p2,
                       StkId res, TMS event) {
   const TValue *tm = solT_gettmbyobj(L, p1, event);  /* try first operand */
@@ -164,6 +190,22 @@ void solT_trybinTM (sol_State *L, const TValue *p1, const TValue *p2,
 }
 
 
+/*
+** Same as 'solT_trybinTM', but when the metamethod is a Sol function
+** it is pushed (see 'solT_pushTM') and its CallInfo is returned.
+*/
+CallInfo *solT_pushbinTM (sol_State *L, const TValue *p1, const TValue *p2,
+                          StkId res, TMS event) {
+  const TValue *tm = solT_gettmbyobj(L, p1, event);  /* try first operand */
+  if (notm(tm))
+    tm = solT_gettmbyobj(L, p2, event);  /* try second operand */
+  if (ttisLclosure(tm))
+    return solT_pushTM(L, tm, p1, p2, NULL, 1);
+  solT_trybinTM(L, p1, p2, res, event);  /* C function or error */
+  return NULL;
+}
+
+
 void solT_tryconcatTM (sol_State *L) {
   StkId top = L->top.p;
   if (l_unlikely(!callbinTM(L, s2v(top - 2), s2v(top - 1), top - 2,
@@ -82,8 +82,13 @@ SOLI_FUNC void solT_callTM (sol_State *L, const TValue *f, const TValue *p1,
                             const TValue *p2, const TValue *p3);
 SOLI_FUNC void solT_callTMres (sol_State *L, const TValue *f,
                             const TValue *p1, const TValue *p2, StkId p3);
+SOLI_FUNC struct CallInfo *solT_pushTM (sol_State *L, const TValue *f,
+                      const TValue *p1, const TValue *p2, const TValue *p3,
+                      int nresults);
 SOLI_FUNC void solT_trybinTM (sol_State *L, const TValue *p1, const TValue *p2,
                               StkId res, TMS event);
+SOLI_FUNC struct CallInfo *solT_pushbinTM (sol_State *L, const TValue *p1,
+                                   const TValue *p2, StkId res, TMS event);
 SOLI_FUNC void solT_tryconcatTM (sol_State *L);
 SOLI_FUNC void solT_trybinassocTM (sol_State *L, const TValue *p1,
        const TValue *p2, int inv, StkId res, TMS event);
@@ -18,9 +18,11 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstring.h"
+#include "ltable.h"
 #include "lundump.h"
 #include "lzio.h"
 
@@ -34,6 +36,11 @@ typedef struct {
   sol_State *L;
   ZIO *Z;
   const char *name;
+  int aligned;  /* chunk in aligned format? */
+  int fixed;  /* buffer is fixed and outlives the prototypes? */
+  int strings;  /* chunk has string tables? */
+  Table *h;  /* saved strings (indexed by their order) */
+  int nstr;  /* number of saved strings */
 } LoadState;
 
 
@@ -105,7 +112,20 @@ static sol_Integer loadInteger (LoadState *S) {
 
 
 /*
-** Load a nullable string into prototype 'p'.
+** Start a new (empty) string table, anchored in the stack.
+*/
+static void newstrings (LoadState *S) {
+  sol_State *L = S->L;
+  S->h = solH_new(L);
+  S->nstr = 0;
+  sethvalue2s(L, L->top.p, S->h);
+  solD_inctop(L);
+}
+
+
+/*
+** Load a nullable string into prototype 'p'. With string tables, each
+** string is created only once; its later occurrences are its index.
 */
 static TString *loadStringN (LoadState *S, Proto *p) {
   sol_State *L = S->L;
@@ -113,16 +133,31 @@ static TString *loadStringN (LoadState *S, Proto *p) {
   size_t size = loadSize(S);
   if (size == 0)  /* no string? */
     return NULL;
-  else if (--size <= SOLI_MAXSHORTLEN) {  /* short string? */
-    char buff[SOLI_MAXSHORTLEN];
-    loadVector(S, buff, size);  /* load string into buffer */
-    ts = solS_newlstr(L, buff, size);  /* create string */
+  else if (S->strings && size == 1) {  /* string already loaded? */
+    int idx = loadInt(S);
+    if (idx < 1 || idx > S->nstr)
+      error(S, "bad string index");
+    ts = tsvalue(solH_getint(S->h, idx));
   }
-  else {  /* long string */
-    ts = solS_createlngstrobj(L, size);  /* create string */
-    setsvalue2s(L, L->top.p, ts);  /* anchor it ('loadVector' can GC) */
-    solD_inctop(L);
-    loadVector(S, getlngstr(ts), size);  /* load directly in final place */
+  else {
+    size -= (S->strings) ? 2 : 1;
+    if (size <= SOLI_MAXSHORTLEN) {  /* short string? */
+      char buff[SOLI_MAXSHORTLEN];
+      loadVector(S, buff, size);  /* load string into buffer */
+      ts = solS_newlstr(L, buff, size);  /* create string */
+      setsvalue2s(L, L->top.p, ts);  /* anchor it */
+      solD_inctop(L);
+    }
+    else {  /* long string */
+      ts = solS_createlngstrobj(L, size);  /* create string */
+      setsvalue2s(L, L->top.p, ts);  /* anchor it ('loadVector' can GC) */
+      solD_inctop(L);
+      loadVector(S, getlngstr(ts), size);  /* load directly in final place */
+    }
+    if (S->strings) {  /* save it for later occurrences */
+      solH_setint(L, S->h, ++S->nstr, s2v(L->top.p - 1));
+      solC_objbarrierback(L, obj2gco(S->h), ts);
+    }
     L->top.p--;  /* pop string */
   }
   solC_objbarrier(L, p, ts);
@@ -141,8 +176,52 @@ static TString *loadString (LoadState *S, Proto *p) {
 }
 
 
+/*
+** Skip the padding before an aligned vector.
+*/
+static void loadAlign (LoadState *S, size_t align) {
+  int pad = loadByte(S);
+  if (cast_sizet(pad) >= align)
+    error(S, "bad alignment");
+  while (pad-- > 0)
+    (void)loadByte(S);
+}
+
+
+/*
+** Address of a vector of 'n' elements of type 't' to be used in place,
+** or NULL if it cannot be (buffer not fixed, vector not contiguous or
+** misaligned). Any vector used in place makes its prototype PF_FIXED.
+*/
+#define getaddr(S,f,n,t) \
+	cast(t *, getaddr_(S, f, cast_sizet(n) * sizeof(t), sizeof(t)))
+
+static const void *getaddr_ (LoadState *S, Proto *f, size_t size,
+                                                      size_t align) {
+  const void *p;
+  if (!S->fixed || size == 0)
+    return NULL;
+  p = solZ_getaddr(S->Z, size, align);
+  if (p != NULL) {
+    if (!isfixed(f)) {  /* first vector in place? */
+      sol_assert(f->lineinfo == NULL && f->abslineinfo == NULL);
+      f->flag |= PF_FIXED;
+    }
+  }
+  return p;
+}
+
+
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
+  if (S->aligned) {
+    loadAlign(S, sizeof(Instruction));
+    f->code = getaddr(S, f, n, Instruction);
+    if (f->code != NULL) {  /* used in place? */
+      f->sizecode = n;
+      return;
+    }
+  }
   f->code = solM_newvectorchecked(S->L, n, Instruction);
   f->sizecode = n;
   loadVector(S, f->code, n);
@@ -188,6 +267,33 @@ static void loadConstants (LoadState *S, Proto *f) {
 }
 
 
+/*
+** Read the size of a nested function. From a fixed buffer, also skip
+** its body and return the address of its size (which precedes the
+** body); otherwise, return NULL.
+*/
+static const char *lazyaddr (LoadState *S) {
+  const char *lazy = NULL;
+  size_t size;
+  if (S->fixed)
+    lazy = cast_charp(solZ_getaddr(S->Z, sizeof(size_t), 1));
+  if (lazy == NULL) {  /* not fixed or not contiguous? */
+    loadVar(S, size);
+    return NULL;
+  }
+  memcpy(&size, lazy, sizeof(size));
+  if (size == 0 || solZ_getaddr(S->Z, size, 1) == NULL)
+    error(S, "truncated chunk");
+  return lazy;
+}
+
+
+/*
+** In the aligned format, each nested function is preceded by its size.
+** From a fixed buffer, the function is not loaded: its prototype only
+** keeps the address of its body, to be loaded by 'solU_loadlazy' when
+** the first closure is created.
+*/
 static void loadProtos (LoadState *S, Proto *f) {
   int i;
   int n = loadInt(S);
@@ -196,9 +302,25 @@ static void loadProtos (LoadState *S, Proto *f) {
   for (i = 0; i < n; i++)
     f->p[i] = NULL;
   for (i = 0; i < n; i++) {
-    f->p[i] = solF_newproto(S->L);
-    solC_objbarrier(S->L, f, f->p[i]);
-    loadFunction(S, f->p[i], f->source);
+    Proto *nf = f->p[i] = solF_newproto(S->L);
+    solC_objbarrier(S->L, f, nf);
+    if (S->aligned && (nf->lazy = lazyaddr(S)) != NULL) {
+      nf->source = f->source;  /* parent's source, until it is loaded */
+      if (S->strings)
+        nf->flag |= PF_STRINGS;
+      continue;
+    }
+    if (S->aligned && S->strings) {  /* function has its own strings? */
+      Table *h = S->h;
+      int nstr = S->nstr;
+      newstrings(S);
+      loadFunction(S, nf, f->source);
+      S->L->top.p--;  /* pop string table */
+      S->h = h;
+      S->nstr = nstr;
+    }
+    else
+      loadFunction(S, nf, f->source);
   }
 }
 
@@ -224,18 +346,41 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 }
 
 
+/*
+** A prototype is either PF_FIXED, with all of 'code', 'lineinfo' and
+** 'abslineinfo' in the buffer, or owns them all. So, these vectors are
+** used in place if and only if the code was. (In a fixed buffer, where
+** the code was contiguous and aligned, so is the rest.)
+*/
+#define loadFixedVector(S,f,v,sz,n,t) {  \
+  if (isfixed(f) && (n) > 0) {  \
+    (v) = getaddr(S, f, n, t);  \
+    if ((v) == NULL) error(S, "misaligned vector");  \
+    (sz) = (n);  \
+  }  \
+  else {  \
+    (v) = solM_newvectorchecked(S->L, n, t);  \
+    (sz) = (n);  \
+    loadVector(S, v, n);  \
+  } }
+
+
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
   n = loadInt(S);
-  f->lineinfo = solM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+  loadFixedVector(S, f, f->lineinfo, f->sizelineinfo, n, ls_byte);
   n = loadInt(S);
-  f->abslineinfo = solM_newvectorchecked(S->L, n, AbsLineInfo);
-  f->sizeabslineinfo = n;
-  for (i = 0; i < n; i++) {
-    f->abslineinfo[i].pc = loadInt(S);
-    f->abslineinfo[i].line = loadInt(S);
+  if (S->aligned) {
+    loadAlign(S, sizeof(AbsLineInfo));
+    loadFixedVector(S, f, f->abslineinfo, f->sizeabslineinfo, n, AbsLineInfo);
+  }
+  else {
+    f->abslineinfo = solM_newvectorchecked(S->L, n, AbsLineInfo);
+    f->sizeabslineinfo = n;
+    for (i = 0; i < n; i++) {
+      f->abslineinfo[i].pc = loadInt(S);
+      f->abslineinfo[i].line = loadInt(S);
+    }
   }
   n = loadInt(S);
   f->locvars = solM_newvectorchecked(S->L, n, LocVar);
@@ -294,12 +439,23 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, &SOL_SIGNATURE[1], "not a binary chunk");
   if (loadByte(S) != SOLC_VERSION)
     error(S, "version mismatch");
-  if (loadByte(S) != SOLC_FORMAT)
-    error(S, "format mismatch");
+  switch (loadByte(S)) {
+    case SOLC_FORMAT: S->aligned = 0; S->strings = 0; break;
+    case SOLC_FORMATALIGNED: S->aligned = 1; S->strings = 0; break;
+    case SOLC_FORMAT | SOLC_FORMATSTRINGS:
+      S->aligned = 0; S->strings = 1; break;
+    case SOLC_FORMATALIGNED | SOLC_FORMATSTRINGS:
+      S->aligned = 1; S->strings = 1; break;
+    default: error(S, "format mismatch");
+  }
   checkliteral(S, SOLC_DATA, "corrupted chunk");
   checksize(S, Instruction);
   checksize(S, sol_Integer);
   checksize(S, sol_Number);
+  if (S->aligned) {
+    checksize(S, AbsLineInfo);
+    checksize(S, size_t);
+  }
   if (loadInteger(S) != SOLC_INT)
     error(S, "integer format mismatch");
   if (loadNumber(S) != SOLC_NUM)
@@ -307,27 +463,115 @@ static void checkHeader (LoadState *S) {
 }
 
 
+typedef struct LazyBody {
+  const char *b;
+  size_t size;
+} LazyBody;
+
+
+static const char *getlazy (sol_State *L, void *ud, size_t *size) {
+  LazyBody *lb = cast(LazyBody *, ud);
+  UNUSED(L);
+  if (lb->size == 0)
+    return NULL;
+  *size = lb->size;
+  lb->size = 0;  /* it is read only once */
+  return lb->b;
+}
+
+
+static const char *chunkname (const char *name) {
+  if (*name == '@' || *name == '=')
+    return name + 1;
+  else if (*name == SOL_SIGNATURE[0])
+    return "binary string";
+  else
+    return name;
+}
+
+
 /*
-** Load precompiled chunk.
+** Load the body of lazy prototype 'f'. The body is loaded into a new
+** prototype (anchored by a closure in the stack) that is then moved
+** into 'f', so that 'f' is left unchanged in case of errors.
 */
-LClosure *solU_undump(sol_State *L, ZIO *Z, const char *name) {
+void solU_loadlazy (sol_State *L, Proto *f) {
   LoadState S;
+  ZIO z;
+  LazyBody lb;
   LClosure *cl;
-  if (*name == '@' || *name == '=')
-    S.name = name + 1;
-  else if (*name == SOL_SIGNATURE[0])
-    S.name = "binary string";
-  else
-    S.name = name;
+  Proto *nf;
+  sol_assert(f->lazy != NULL);
+  memcpy(&lb.size, f->lazy, sizeof(size_t));
+  lb.b = f->lazy + sizeof(size_t);
+  solZ_init(L, &z, getlazy, &lb);
+  S.L = L;
+  S.Z = &z;
+  S.name = (f->source != NULL) ? chunkname(getstr(f->source)) : "?";
+  S.aligned = S.fixed = 1;
+  S.strings = (f->flag & PF_STRINGS) != 0;
+  cl = solF_newLclosure(L, 0);
+  setclLvalue2s(L, L->top.p, cl);
+  solD_inctop(L);
+  cl->p = nf = solF_newproto(L);
+  solC_objbarrier(L, cl, nf);
+  if (S.strings)
+    newstrings(&S);
+  loadFunction(&S, nf, f->source);
+  if (S.strings)
+    L->top.p--;  /* pop string table */
+  soli_verifycode(L, nf);
+  /* move the body into 'f' */
+  f->numparams = nf->numparams;
+  f->is_vararg = nf->is_vararg;
+  f->maxstacksize = nf->maxstacksize;
+  f->flag = nf->flag;
+  f->sizeupvalues = nf->sizeupvalues; f->upvalues = nf->upvalues;
+  f->sizek = nf->sizek; f->k = nf->k;
+  f->sizecode = nf->sizecode; f->code = nf->code;
+  f->sizelineinfo = nf->sizelineinfo; f->lineinfo = nf->lineinfo;
+  f->sizep = nf->sizep; f->p = nf->p;
+  f->sizelocvars = nf->sizelocvars; f->locvars = nf->locvars;
+  f->sizeabslineinfo = nf->sizeabslineinfo;
+  f->abslineinfo = nf->abslineinfo;
+  f->linedefined = nf->linedefined;
+  f->lastlinedefined = nf->lastlinedefined;
+  f->source = nf->source;
+  f->lazy = NULL;
+  nf->flag = 0;  /* 'nf' is now empty */
+  nf->sizeupvalues = nf->sizek = nf->sizecode = nf->sizelineinfo = 0;
+  nf->sizep = nf->sizelocvars = nf->sizeabslineinfo = 0;
+  nf->upvalues = NULL; nf->k = NULL; nf->code = NULL; nf->lineinfo = NULL;
+  nf->p = NULL; nf->locvars = NULL; nf->abslineinfo = NULL;
+  if (isblack(f))  /* 'f' got new references? */
+    solC_barrierback_(L, obj2gco(f));
+  L->top.p--;  /* pop closure */
+}
+
+
+/*
+** Load precompiled chunk. If 'fixed', the buffer returned by the reader
+** is not changed nor freed while the loaded functions exist, so that
+** vectors of an aligned chunk can be used in place.
+*/
+LClosure *solU_undump(sol_State *L, ZIO *Z, const char *name, int fixed) {
+  LoadState S;
+  LClosure *cl;
+  S.name = chunkname(name);
   S.L = L;
   S.Z = Z;
+  S.fixed = fixed;
   checkHeader(&S);
   cl = solF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top.p, cl);
   solD_inctop(L);
   cl->p = solF_newproto(L);
   solC_objbarrier(L, cl, cl->p);
+  if (S.strings)
+    newstrings(&S);
   loadFunction(&S, cl->p, NULL);
+  if (S.strings)
+    L->top.p--;  /* pop string table */
   sol_assert(cl->nupvalues == cl->p->sizeupvalues);
   soli_verifycode(L, cl->p);
   return cl;
@@ -25,11 +25,33 @@
 
 #define SOLC_FORMAT	0	/* this is the official format */
 
+/*
+** Aligned format: the instruction and absolute line-info vectors are
+** preceded by padding that aligns them (relative to the beginning of
+** the chunk) to their element size, and 'abslineinfo' is stored as in
+** memory, so that a chunk loaded from a fixed buffer can be used in
+** place. Each nested function is preceded by its size (a 'size_t'),
+** so that, from a fixed buffer, it can be loaded only when needed.
+*/
+#define SOLC_FORMATALIGNED	1
+
+/*
+** Flag added to the format: each string is saved only once per chunk;
+** a later occurrence is saved as the index of its first one. In the
+** aligned format, each nested function starts its own string table,
+** so that it can be loaded by itself.
+*/
+#define SOLC_FORMATSTRINGS	2
+
 /* load one chunk; from lundump.c */
-SOLI_FUNC LClosure* solU_undump (sol_State* L, ZIO* Z, const char* name);
+SOLI_FUNC LClosure* solU_undump (sol_State* L, ZIO* Z, const char* name,
+                                 int fixed);
+
+/* load the body of a lazy prototype; from lundump.c */
+SOLI_FUNC void solU_loadlazy (sol_State *L, Proto *f);
 
 /* dump one chunk; from ldump.c */
 SOLI_FUNC int solU_dump (sol_State* L, const Proto* f, sol_Writer w,
-                         void* data, int strip);
+                         void* data, int strip, int aligned);
 
 #endif
@@ -28,6 +28,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
 
@@ -281,13 +282,63 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Execute a step of a generic for loop in-line, when its iterator is
+** the base library's 'next' or 'ipairs' iterator (see 'sol_setiterators')
+** and its state is a table. Returns false when the iterator must be
+** called after all. For 'next', 'ra + 3' keeps the traversal cursor
+** (see OP_TFORPREP).
+*/
+l_sinline int forinline (sol_State *L, StkId ra, int nres) {
+  sol_CFunction f = fvalue(s2v(ra));
+  Table *h = hvalue(s2v(ra + 1));
+  if (f == G(L)->inextf) {
+    const TValue *slot;
+    sol_Integer n;
+    if (!ttisinteger(s2v(ra + 2)))
+      return 0;
+    n = intop(+, ivalue(s2v(ra + 2)), 1);
+    slot = (l_castS2U(n) - 1u < h->alimit) ? &h->array[n - 1]
+                                           : solH_getint(h, n);
+    if (isempty(slot)) {
+      if (fasttm(L, h->metatable, TM_INDEX) != NULL)
+        return 0;  /* let 'ipairs' call the metamethod */
+      setnilvalue(s2v(ra + 4));  /* end of the loop */
+      return 1;
+    }
+    setivalue(s2v(ra + 4), n);
+    setobj2s(L, ra + 5, slot);
+  }
+  else if (f == G(L)->nextf && ttisinteger(s2v(ra + 3))) {
+    unsigned int cursor = cast_uint(ivalue(s2v(ra + 3)));
+    int res;
+    setobjs2s(L, ra + 4, ra + 2);
+    res = solH_nextcursor(L, h, ra + 4, &cursor);
+    if (res < 0)
+      return 0;  /* invalid key; let 'next' raise the error */
+    setivalue(s2v(ra + 3), cursor);
+    if (res == 0) {
+      setnilvalue(s2v(ra + 4));  /* end of the loop */
+      return 1;
+    }
+  }
+  else
+    return 0;
+  for (; nres > 2; nres--)  /* complete missing results */
+    setnilvalue(s2v(ra + 3 + nres));
+  return 1;
+}
+
+
 /*
 ** Finish the table access 'val = t[key]'.
 ** if 'slot' is NULL, 't' is not a table; otherwise, 'slot' points to
-** t[k] entry (which must be empty).
+** t[k] entry (which must be empty). When 'push' is true (calls from
+** the VM), a metamethod that is a Sol function is only pushed (see
+** 'solT_pushTM') and its CallInfo returned.
 */
-void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
-                      const TValue *slot) {
+l_sinline CallInfo *finishget (sol_State *L, const TValue *t, TValue *key,
+                               StkId val, const TValue *slot, int push) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -303,22 +354,31 @@ void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
       tm = fasttm(L, hvalue(t)->metatable, TM_INDEX);  /* table's metamethod */
       if (tm == NULL) {  /* no metamethod? */
         setnilvalue(s2v(val));  /* result is nil */
-        return;
+        return NULL;
       }
       /* else will try the metamethod */
     }
     if (ttisfunction(tm)) {  /* is metamethod a function? */
+      if (push && ttisLclosure(tm))
+        return solT_pushTM(L, tm, t, key, NULL, 1);
       solT_callTMres(L, tm, t, key, val);  /* call it */
-      return;
+      return NULL;
     }
     t = tm;  /* else try to access 'tm[key]' */
     if (solV_fastget(L, t, key, slot, solH_get)) {  /* fast track? */
       setobj2s(L, val, slot);  /* done */
-      return;
+      return NULL;
     }
     /* else repeat (tail call 'solV_finishget') */
   }
   solG_runerror(L, "'__index' chain too long; possible loop");
+  return NULL;  /* to avoid warnings */
+}
+
+
+void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
+                      const TValue *slot) {
+  finishget(L, t, key, val, slot, 0);
 }
 
 
@@ -327,10 +387,11 @@ void solV_finishget (sol_State *L, const TValue *t, TValue *key, StkId val,
 ** If 'slot' is NULL, 't' is not a table.  Otherwise, 'slot' points
 ** to the entry 't[key]', or to a value with an absent key if there
 ** is no such entry.  (The value at 'slot' must be empty, otherwise
-** 'solV_fastget' would have done the job.)
+** 'solV_fastget' would have done the job.) 'push' works as in
+** 'finishget'.
 */
-void solV_finishset (sol_State *L, const TValue *t, TValue *key,
-                     TValue *val, const TValue *slot) {
+l_sinline CallInfo *finishset (sol_State *L, const TValue *t, TValue *key,
+                               TValue *val, const TValue *slot, int push) {
   int loop;  /* counter to avoid infinite loops */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;  /* '__newindex' metamethod */
@@ -344,8 +405,9 @@ void solV_finishset (sol_State *L, const TValue *t, TValue *key,
         solH_finishset(L, h, key, slot, val);  /* set new value */
         L->top.p--;
         invalidateTMcache(h);
-        solC_barrierback(L, obj2gco(h), val);
-        return;
+        solC_barrierslot(L, h,  /* a new key may be anywhere */
+                         isabstkey(slot) ? solH_get(h, key) : slot, val);
+        return NULL;
       }
       /* else will try the metamethod */
     }
@@ -356,17 +418,26 @@ void solV_finishset (sol_State *L, const TValue *t, TValue *key,
     }
     /* try the metamethod */
     if (ttisfunction(tm)) {
+      if (push && ttisLclosure(tm))
+        return solT_pushTM(L, tm, t, key, val, 0);
       solT_callTM(L, tm, t, key, val);
-      return;
+      return NULL;
     }
     t = tm;  /* else repeat assignment over 'tm' */
     if (solV_fastget(L, t, key, slot, solH_get)) {
       solV_finishfastset(L, t, slot, val);
-      return;  /* done */
+      return NULL;  /* done */
     }
     /* else 'return solV_finishset(L, t, key, val, slot)' (loop) */
   }
   solG_runerror(L, "'__newindex' chain too long; possible loop");
+  return NULL;  /* to avoid warnings */
+}
+
+
+void solV_finishset (sol_State *L, const TValue *t, TValue *key,
+                     TValue *val, const TValue *slot) {
+  finishset(L, t, key, val, slot, 0);
 }
 
 
@@ -789,16 +860,45 @@ sol_Integer solV_shiftl (sol_Integer x, sol_Integer y) {
 }
 
 
+/*
+** check whether cached closure in prototype 'p' may be reused, that is,
+** whether there is a cached closure with the same upvalues needed by
+** new closure to be created.
+*/
+static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
+  LClosure *c = p->cache;
+  if (c != NULL) {  /* is there a cached closure? */
+    int nup = p->sizeupvalues;
+    Upvaldesc *uv = p->upvalues;
+    int i;
+    for (i = 0; i < nup; i++) {  /* check whether it has right upvalues */
+      TValue *v = uv[i].instack ? s2v(base + uv[i].idx)
+                                : encup[uv[i].idx]->v.p;
+      if (c->upvals[i]->v.p != v)
+        return NULL;  /* wrong upvalue; cannot reuse closure */
+    }
+  }
+  return c;  /* return cached closure (or NULL if no cached closure) */
+}
+
+
 /*
 ** create a new Sol closure, push it in the stack, and initialize
-** its upvalues.
+** its upvalues. Before that, check whether the closure created last
+** from the same prototype can be reused, and afterwards cache the new
+** closure in the prototype.
 */
 static void pushclosure (sol_State *L, Proto *p, UpVal **encup, StkId base,
                          StkId ra) {
   int nup = p->sizeupvalues;
   Upvaldesc *uv = p->upvalues;
   int i;
-  LClosure *ncl = solF_newLclosure(L, nup);
+  LClosure *ncl = getcached(p, encup, base);
+  if (ncl != NULL) {  /* reuse it */
+    setclLvalue2s(L, ra, ncl);
+    return;
+  }
+  ncl = solF_newLclosure(L, nup);
   ncl->p = p;
   setclLvalue2s(L, ra, ncl);  /* anchor new closure in stack */
   for (i = 0; i < nup; i++) {  /* fill in its upvalues */
@@ -808,6 +908,8 @@ static void pushclosure (sol_State *L, Proto *p, UpVal **encup, StkId base,
       ncl->upvals[i] = encup[uv[i].idx];
     solC_objbarrier(L, ncl, ncl->upvals[i]);
   }
+  p->cache = ncl;  /* save it on cache for reuse */
+  solC_objbarrierback(L, obj2gco(p), ncl);
 }
 
 
@@ -1124,6 +1226,15 @@ void solV_finishOp (sol_State *L) {
 /* special version that does not change the top */
 #define ProtectNT(exp)  (savepc(L), (exp), updatetrap(ci))
 
+/*
+** Protect code that may push a metamethod frame (see 'solT_pushTM'),
+** which then runs in this same C frame.
+*/
+#define ProtectTM(exp)  \
+	{ CallInfo *tmci; savestate(L,ci); tmci = (exp);  \
+	  if (tmci != NULL) { ci = tmci; goto startfunc; }  \
+	  updatetrap(ci); }
+
 /*
 ** Protect code that can only raise errors. (That is, it cannot change
 ** the stack or hooks.)
@@ -1259,7 +1370,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           setobj2s(L, ra, slot);
         }
         else
-          Protect(solV_finishget(L, upval, rc, ra, slot));
+          ProtectTM(finishget(L, upval, rc, ra, slot, 1));
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
@@ -1274,7 +1385,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           setobj2s(L, ra, slot);
         }
         else
-          Protect(solV_finishget(L, rb, rc, ra, slot));
+          ProtectTM(finishget(L, rb, rc, ra, slot, 1));
         vmbreak;
       }
       vmcase(OP_GETI) {
@@ -1288,7 +1399,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         else {
           TValue key;
           setivalue(&key, c);
-          Protect(solV_finishget(L, rb, &key, ra, slot));
+          ProtectTM(finishget(L, rb, &key, ra, slot, 1));
         }
         vmbreak;
       }
@@ -1302,7 +1413,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           setobj2s(L, ra, slot);
         }
         else
-          Protect(solV_finishget(L, rb, rc, ra, slot));
+          ProtectTM(finishget(L, rb, rc, ra, slot, 1));
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1315,7 +1426,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           solV_finishfastset(L, upval, slot, rc);
         }
         else
-          Protect(solV_finishset(L, upval, rb, rc, slot));
+          ProtectTM(finishset(L, upval, rb, rc, slot, 1));
         vmbreak;
       }
       vmcase(OP_SETTABLE) {
@@ -1330,7 +1441,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           solV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
-          Protect(solV_finishset(L, s2v(ra), rb, rc, slot));
+          ProtectTM(finishset(L, s2v(ra), rb, rc, slot, 1));
         vmbreak;
       }
       vmcase(OP_SETI) {
@@ -1344,7 +1455,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         else {
           TValue key;
           setivalue(&key, c);
-          Protect(solV_finishset(L, s2v(ra), &key, rc, slot));
+          ProtectTM(finishset(L, s2v(ra), &key, rc, slot, 1));
         }
         vmbreak;
       }
@@ -1358,7 +1469,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           solV_finishfastset(L, s2v(ra), slot, rc);
         }
         else
-          Protect(solV_finishset(L, s2v(ra), rb, rc, slot));
+          ProtectTM(finishset(L, s2v(ra), rb, rc, slot, 1));
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -1372,6 +1483,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         if (TESTARG_k(i))  /* non-zero extra argument? */
           c += GETARG_Ax(*pc) * (MAXARG_C + 1);  /* add it to size */
         pc++;  /* skip extra argument */
+        savepc(L);  /* in case allocation is sampled or raises an error */
         L->top.p = ra + 1;  /* correct top in case of emergency GC */
         t = solH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
@@ -1391,7 +1503,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           setobj2s(L, ra, slot);
         }
         else
-          Protect(solV_finishget(L, rb, rc, ra, slot));
+          ProtectTM(finishget(L, rb, rc, ra, slot, 1));
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1517,7 +1629,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         TMS tm = (TMS)GETARG_C(i);
         StkId result = RA(pi);
         sol_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
-        Protect(solT_trybinTM(L, s2v(ra), rb, result, tm));
+        ProtectTM(solT_pushbinTM(L, s2v(ra), rb, result, tm));
         vmbreak;
       }
       vmcase(OP_MMBINI) {
@@ -1527,7 +1639,10 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         TMS tm = (TMS)GETARG_C(i);
         int flip = GETARG_k(i);
         StkId result = RA(pi);
-        Protect(solT_trybiniTM(L, s2v(ra), imm, flip, result, tm));
+        TValue aux;
+        setivalue(&aux, imm);
+        ProtectTM(flip ? solT_pushbinTM(L, &aux, s2v(ra), result, tm)
+                       : solT_pushbinTM(L, s2v(ra), &aux, result, tm));
         vmbreak;
       }
       vmcase(OP_MMBINK) {
@@ -1537,7 +1652,8 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         TMS tm = (TMS)GETARG_C(i);
         int flip = GETARG_k(i);
         StkId result = RA(pi);
-        Protect(solT_trybinassocTM(L, s2v(ra), imm, flip, result, tm));
+        ProtectTM(flip ? solT_pushbinTM(L, imm, s2v(ra), result, tm)
+                       : solT_pushbinTM(L, s2v(ra), imm, result, tm));
         vmbreak;
       }
       vmcase(OP_UNM) {
@@ -1552,7 +1668,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           setfltvalue(s2v(ra), soli_numunm(L, nb));
         }
         else
-          Protect(solT_trybinTM(L, rb, rb, ra, TM_UNM));
+          ProtectTM(solT_pushbinTM(L, rb, rb, ra, TM_UNM));
         vmbreak;
       }
       vmcase(OP_BNOT) {
@@ -1563,7 +1679,7 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
         }
         else
-          Protect(solT_trybinTM(L, rb, rb, ra, TM_BNOT));
+          ProtectTM(solT_pushbinTM(L, rb, rb, ra, TM_BNOT));
         vmbreak;
       }
       vmcase(OP_NOT) {
@@ -1682,8 +1798,11 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
         savepc(L);  /* in case of errors */
-        if ((newci = solD_precall(L, ra, nresults)) == NULL)
-          updatetrap(ci);  /* C call; nothing else to be done */
+        if ((newci = solD_precall(L, ra, nresults)) == NULL) {  /* C call? */
+          if (l_unlikely(L->status == SOL_YIELD))
+            return;  /* direct yield (see 'sol_yieldk') */
+          updatetrap(ci);  /* nothing else to be done */
+        }
         else {  /* Sol call: run function in this same C frame */
           ci = newci;
           goto startfunc;
@@ -1710,6 +1829,8 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         if ((n = solD_pretailcall(L, ci, ra, b, delta)) < 0)  /* Sol function? */
           goto startfunc;  /* execute the callee */
         else {  /* C function? */
+          if (l_unlikely(L->status == SOL_YIELD))
+            return;  /* direct yield (see 'sol_yieldk') */
           ci->func.p -= delta;  /* restore 'func' (if vararg) */
           solD_poscall(L, ci, n);  /* finish caller */
           updatetrap(ci);  /* 'solD_poscall' can change hooks */
@@ -1780,7 +1901,10 @@ void solV_execute (sol_State *L, CallInfo *ci) {
         if (ci->callstatus & CIST_FRESH)
           return;  /* end this frame */
         else {
+          int istm = (ci->callstatus & CIST_TM);
           ci = ci->previous;
+          if (istm)  /* returning from a metamethod? */
+            solV_finishOp(L);  /* finish the instruction that called it */
           goto returning;  /* continue running caller in this frame */
         }
       }
@@ -1814,6 +1938,9 @@ void solV_execute (sol_State *L, CallInfo *ci) {
        StkId ra = RA(i);
         /* create to-be-closed upvalue (if needed) */
         halfProtect(solF_newtbcupval(L, ra + 3));
+        if (ttislcf(s2v(ra)) && fvalue(s2v(ra)) == G(L)->nextf &&
+            l_isfalse(s2v(ra + 3)))
+          setivalue(s2v(ra + 3), 0);  /* cursor for 'forinline' */
         pc += GETARG_Bx(i);
         i = *(pc++);  /* go to next instruction */
         sol_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
@@ -1827,11 +1954,15 @@ void solV_execute (sol_State *L, CallInfo *ci) {
            to-be-closed variable. The call will use the stack after
            these values (starting at 'ra + 4')
         */
-        /* push function, state, and control variable */
-        memcpy(ra + 4, ra, 3 * sizeof(*ra));
-        L->top.p = ra + 4 + 3;
-        ProtectNT(solD_call(L, ra + 4, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
+        if (!(ttislcf(s2v(ra)) && ttistable(s2v(ra + 1)) &&
+              !(L->hookmask & (SOL_MASKCALL | SOL_MASKRET)) &&
+              forinline(L, ra, GETARG_C(i)))) {
+          /* push function, state, and control variable */
+          memcpy(ra + 4, ra, 3 * sizeof(*ra));
+          L->top.p = ra + 4 + 3;
+          ProtectNT(solD_call(L, ra + 4, GETARG_C(i)));  /* do the call */
+          updatestack(ci);  /* stack may have changed */
+        }
         i = *(pc++);  /* go to next instruction */
         sol_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
         goto l_tforloop;
@@ -1865,13 +1996,18 @@ void solV_execute (sol_State *L, CallInfo *ci) {
           TValue *val = s2v(ra + n);
           setobj2t(L, &h->array[last - 1], val);
           last--;
-          solC_barrierback(L, obj2gco(h), val);
+          solC_barrierslot(L, h, &h->array[last], val);
         }
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
-        StkId ra = RA(i);
+        StkId ra;
         Proto *p = cl->p->p[GETARG_Bx(i)];
+        if (l_unlikely(p->lazy != NULL)) {  /* body not loaded yet? */
+          Protect(solU_loadlazy(L, p));
+          updatebase(ci);  /* stack may have been reallocated */
+        }
+        ra = RA(i);
         halfProtect(pushclosure(L, p, cl->upvals, base, ra));
         checkGC(L, ra + 1);
         vmbreak;
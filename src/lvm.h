@@ -107,7 +107,7 @@ typedef enum {
 */
 #define solV_finishfastset(L,t,slot,v) \
     { setobj2t(L, cast(TValue *,slot), v); \
-      solC_barrierback(L, gcvalue(t), v); }
+      solC_barrierslot(L, hvalue(t), slot, v); }
 
 
 /*
@@ -66,3 +66,25 @@ size_t solZ_read (ZIO *z, void *b, size_t n) {
   return 0;
 }
 
+
+/*
+** If the next 'n' bytes are contiguous in the current block and their
+** address is a multiple of 'align', skip them and return their address;
+** otherwise, return NULL without consuming anything.
+*/
+const void *solZ_getaddr (ZIO *z, size_t n, size_t align) {
+  const void *res;
+  if (z->n == 0) {  /* no bytes in buffer? */
+    if (solZ_fill(z) == EOZ)  /* try to read more */
+      return NULL;
+    z->n++;  /* solZ_fill consumed first byte; put it back */
+    z->p--;
+  }
+  if (z->n < n || (cast_sizet(z->p) & (align - 1)) != 0)
+    return NULL;
+  res = z->p;
+  z->n -= n;
+  z->p += n;
+  return res;
+}
+
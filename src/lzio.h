@@ -47,6 +47,7 @@ typedef struct Mbuffer {
 SOLI_FUNC void solZ_init (sol_State *L, ZIO *z, sol_Reader reader,
                                         void *data);
 SOLI_FUNC size_t solZ_read (ZIO* z, void *b, size_t n);	/* read next n bytes */
+SOLI_FUNC const void *solZ_getaddr (ZIO* z, size_t n, size_t align);
 
 
 
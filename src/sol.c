@@ -91,9 +91,11 @@ static void print_usage (const char *badoption) {
   "Available options are:\n"
   "  -e stat   execute string 'stat'\n"
   "  -i        enter interactive mode after executing 'script'\n"
+  "  -I img    load image 'img' (see option -S)\n"
   "  -l mod    require library 'mod' into global 'mod'\n"
   "  -l g=mod  require library 'mod' into global 'g'\n"
   "  -v        show version information\n"
+  "  -S img    save an image of the loaded modules into 'img'\n"
   "  -E        ignore environment variables\n"
   "  -W        turn warnings on\n"
   "  --        stop handling options\n"
@@ -324,7 +326,7 @@ static int collectargs (char **argv, int *first) {
         break;
       case 'e':
         args |= has_e;  /* FALLTHROUGH */
-      case 'l':  /* both options need an argument */
+      case 'l':  case 'I':  case 'S':  /* options with an argument */
         if (argv[i][2] == '\0') {  /* no concatenated argument? */
           i++;  /* try next 'argv' */
           if (argv[i] == NULL || argv[i][0] == '-')
@@ -341,8 +343,26 @@ static int collectargs (char **argv, int *first) {
 
 
 /*
-** Processes options 'e' and 'l', which involve running Sol code, and
-** 'W', which also affects the state.
+** Load image 'fname', keeping the current 'arg' table. (It is out of
+** the globals while loading, so that it is not updated from the image.)
+*/
+static int doimage (sol_State *L, const char *fname) {
+  int status;
+  sol_getglobal(L, "arg");
+  sol_pushnil(L);
+  sol_setglobal(L, "arg");
+  status = solL_loadimage(L, fname);
+  if (status != SOL_OK)
+    sol_rotate(L, -2, 1);  /* put 'arg' above the error message */
+  sol_setglobal(L, "arg");  /* restore 'arg' in both cases */
+  return report(L, status);
+}
+
+
+/*
+** Processes options 'e' and 'l', which involve running Sol code, 'W',
+** which also affects the state, and 'I' and 'S', which load and save
+** images.
 ** Returns 0 if some code raises an error.
 */
 static int runargs (sol_State *L, char **argv, int n) {
@@ -362,6 +382,16 @@ static int runargs (sol_State *L, char **argv, int n) {
         if (status != SOL_OK) return 0;
         break;
       }
+      case 'I':  case 'S': {
+        int status;
+        char *fname = argv[i] + 2;
+        if (*fname == '\0') fname = argv[++i];
+        sol_assert(fname != NULL);
+        status = (option == 'I') ? doimage(L, fname)
+                                 : report(L, solL_saveimage(L, fname));
+        if (status != SOL_OK) return 0;
+        break;
+      }
       case 'W':
         sol_warning(L, "@on", 0);  /* warnings on */
         break;
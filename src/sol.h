@@ -137,6 +137,31 @@ typedef void (*sol_WarnFunction) (void *ud, const char *msg, int tocont);
 typedef struct sol_Debug sol_Debug;
 
 
+/*
+** Type used to report garbage-collector statistics
+*/
+typedef struct sol_GCStats sol_GCStats;
+
+
+/*
+** Type for functions that observe sampled allocations
+*/
+typedef void (*sol_SampleFunction) (void *ud, sol_State *L, const void *p,
+                                    const void *op, int tt, size_t sz);
+
+
+/*
+** Type for functions that give free memory back to the system
+*/
+typedef int (*sol_ReleaseFunction) (void *ud, size_t inuse);
+
+
+/*
+** Type for functions called when a state is closed
+*/
+typedef void (*sol_CloseFunction) (void *ud);
+
+
 /*
 ** Functions to be called by the debugger in specific events
 */
@@ -300,7 +325,14 @@ SOL_API int   (sol_pcallk) (sol_State *L, int nargs, int nresults, int errfunc,
 SOL_API int   (sol_load) (sol_State *L, sol_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
+/* load a data chunk (mode 'd'), pushing its value instead of a function */
+#define sol_loaddata(L,reader,dt,chunkname) \
+	sol_load(L, (reader), (dt), (chunkname), "d")
+
 SOL_API int (sol_dump) (sol_State *L, sol_Writer writer, void *data, int strip);
+/* dump in the aligned format, to be loaded in place (mode 'B') */
+SOL_API int (sol_dumpaligned) (sol_State *L, sol_Writer writer, void *data,
+                               int strip);
 
 
 /*
@@ -338,10 +370,102 @@ SOL_API void (sol_warning)  (sol_State *L, const char *msg, int tocont);
 #define SOL_GCISRUNNING		9
 #define SOL_GCGEN		10
 #define SOL_GCINC		11
+#define SOL_GCADAPT		12
+#define SOL_GCRELEASE		13
+#define SOL_GCDEFERFIN		14
+#define SOL_GCRUNFIN		15
 
 SOL_API int (sol_gc) (sol_State *L, int what, ...);
 
 
+/*
+** garbage-collection statistics
+*/
+
+/* collector phases, as indices into 'phasetime' */
+#define SOL_GCPPROPAGATE	0
+#define SOL_GCPATOMIC		1
+#define SOL_GCPSWEEP		2
+#define SOL_GCPCALLFIN		3
+#define SOL_GCPHASES		4
+
+/* bins in the pause histogram; bin 'i' counts pauses below 2^i us */
+#define SOL_GCPAUSEBINS		16
+
+/* types counted in 'nfreed' (basic types plus upvalues and prototypes) */
+#define SOL_GCNTYPES		(SOL_NUMTYPES + 2)
+
+struct sol_GCStats {
+  double phasetime[SOL_GCPHASES];  /* seconds spent in each phase */
+  double pausetime;  /* total seconds spent in collector pauses */
+  double maxpause;  /* longest pause, in seconds */
+  size_t pausehist[SOL_GCPAUSEBINS];  /* histogram of pause durations */
+  size_t npauses;  /* number of pauses (steps and full collections) */
+  size_t nminor;  /* number of minor (young) collections */
+  size_t nmajor;  /* number of major (complete) collections */
+  size_t nemergency;  /* number of emergency collections */
+  size_t nreleases;  /* number of calls to the release function */
+  size_t pendingfin;  /* objects waiting for their finalizers to run */
+  size_t nstackgrow;  /* number of stack reallocations to a larger size */
+  size_t nstackshrink;  /* number of stack reallocations to a smaller size */
+  size_t ncichunks;  /* number of CallInfo chunks allocated */
+  size_t bytesmarked;  /* bytes found alive at the end of collections */
+  size_t bytesswept;  /* bytes freed by the collector */
+  size_t nfreed[SOL_GCNTYPES];  /* number of objects freed, by type */
+};
+
+SOL_API void (sol_gcstats) (sol_State *L, sol_GCStats *st);
+
+
+/*
+** allocation sampling: 'f' is called with 'op' == NULL for the block 'p'
+** holding every 'interval'-th allocated byte (growing a block counts
+** only its new 'sz' bytes); 'tt' is the type of an object (as in 'nfreed'
+** above) or SOL_TNONE. While a sampler is installed, 'f' also sees every
+** block 'op' that is freed ('p' == NULL) or resized to 'sz' bytes at 'p'.
+*/
+SOL_API void (sol_setsampler) (sol_State *L, sol_SampleFunction f, void *ud,
+                               size_t interval);
+
+/*
+** heap snapshot: writes every object with its size and references; the
+** writer must not call other API functions
+*/
+SOL_API int (sol_snapshot) (sol_State *L, sol_Writer writer, void *data);
+
+/*
+** memory release: after major collections that leave the heap much
+** smaller than its peak, 'f' is called to give free memory back to the
+** system (it must not call other API functions)
+*/
+SOL_API void (sol_setreleasef) (sol_State *L, sol_ReleaseFunction f, void *ud);
+
+/*
+** memory limit: allocations that would take the heap over 'limit' bytes
+** run an emergency collection and then fail with a memory error (0
+** means no limit); returns the previous limit. SOL_QUERYLIMIT only
+** returns the current limit, without changing it.
+*/
+#define SOL_QUERYLIMIT	(~(size_t)0)
+
+SOL_API size_t (sol_setmemlimit) (sol_State *L, size_t limit);
+
+/*
+** iterators: generic 'for' loops whose iterator is 'next' (a function
+** behaving like 'next' over tables) or 'inext' (like the 'ipairs'
+** iterator) are run by the VM without calling them
+*/
+SOL_API void (sol_setiterators) (sol_State *L, sol_CFunction next,
+                                               sol_CFunction inext);
+
+/*
+** close functions: 'f' is called when the state is closed, after all
+** objects were collected (and all finalizers called), with a block of
+** 'size' bytes that lives until then; returns that block
+*/
+SOL_API void *(sol_atclose) (sol_State *L, sol_CloseFunction f, size_t size);
+
+
 /*
 ** miscellaneous functions
 */
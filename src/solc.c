@@ -15,6 +15,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(SOL_USE_POSIX)
+#include <pthread.h>
+#define SOLC_USE_THREADS
+#endif
+
 #include "sol.h"
 #include "lauxlib.h"
 
@@ -34,6 +39,9 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int aligning=0;			/* dump in aligned format? */
+static int bundling=0;			/* bundle files as preloaded modules? */
+static int jobs=1;			/* number of compiling threads */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -60,6 +68,11 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -a       dump in aligned format (for loading in place with mode 'B')\n"
+  "  -b       bundle files as modules in package.preload (use mod=file\n"
+  "           to name a module; default is the file name, as in 'require';\n"
+  "           standard input needs a name, as in mod=-)\n"
+  "  -j n     compile files on 'n' threads (output is the same)\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
@@ -90,6 +103,17 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-a"))			/* aligned format */
+   aligning=1;
+  else if (IS("-b"))			/* bundle modules */
+   bundling=1;
+  else if (IS("-j"))			/* parallel compilation */
+  {
+   const char* n=argv[++i];
+   char* end;
+   if (n==NULL || (jobs=(int)strtol(n,&end,10))<1 || *end!=0)
+    usage("'-j' needs a positive number");
+  }
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -159,33 +183,219 @@ static const Proto* combine(sol_State* L, int n)
  }
 }
 
+/*
+** bundle: the main function registers each file as a module, as in
+**   local p=package.preload
+**   p["a.b"]=function(...)end
+** with each function replaced by the main function of a file
+*/
+
+#define BUNDLEHEAD "local p=package.preload\n"
+
+static const char* modname(sol_State* L, const char* arg, const char** filename)
+{
+ const char* eq=strchr(arg,'=');
+ const char* s;
+ size_t n;
+ if (eq!=NULL)				/* explicit name */
+ {
+  *filename=eq+1;
+  s=sol_pushlstring(L,arg,eq-arg);
+ }
+ else if (strcmp(arg,"-")==0)		/* stdin has no file name */
+  fatal("standard input needs a module name (use mod=-)");
+ else					/* name from file name */
+ {
+  const char* dot;
+  *filename=arg;
+  while (arg[0]=='.' && arg[1]=='/') arg+=2;
+  dot=strrchr(arg,'.');
+  if (dot==NULL || strchr(dot,'/')!=NULL) dot=arg+strlen(arg);
+  sol_pushlstring(L,arg,dot-arg);
+  solL_gsub(L,sol_tostring(L,-1),"/",".");
+  sol_remove(L,-2);
+  s=sol_tolstring(L,-1,&n);
+  if (n>5 && strcmp(s+n-5,".init")==0)	/* 'a/init.sol' is module 'a' */
+  {
+   sol_pushlstring(L,s,n-5);
+   sol_remove(L,-2);
+  }
+  s=sol_tostring(L,-1);
+ }
+ for (n=0; s[n]!=0; n++)
+  if (!isalnum((unsigned char)s[n]) && strchr("_.-",s[n])==NULL) break;
+ if (n==0 || s[n]!=0)
+ {
+  sol_pushfstring(L,"invalid module name '%s' for '%s'",s,*filename);
+  fatal(sol_tostring(L,-1));
+ }
+ return s;
+}
+
+static const Proto* bundle(sol_State* L, int n, char** argv)
+{
+ solL_Buffer b;
+ Proto* f;
+ int i;
+ int top=sol_gettop(L);			/* the n functions end here */
+ if (!sol_checkstack(L,n+4)) fatal("too many input files");
+ for (i=0; i<n; i++)			/* module names */
+ {
+  const char* filename;
+  modname(L,argv[i],&filename);
+ }
+ solL_buffinit(L,&b);
+ solL_addstring(&b,BUNDLEHEAD);
+ for (i=0; i<n; i++)
+ {
+  solL_addstring(&b,"p[\"");
+  solL_addstring(&b,sol_tostring(L,top+1+i));
+  solL_addstring(&b,"\"]=function(...)end\n");
+ }
+ solL_pushresult(&b);
+ if (solL_loadbuffer(L,sol_tostring(L,-1),sol_rawlen(L,-1),"=(" PROGNAME ")")!=SOL_OK)
+  fatal(sol_tostring(L,-1));
+ f=toproto(L,-1);
+ for (i=0; i<n; i++)
+ {
+  f->p[i]=toproto(L,i-2*n-2);
+  if (f->p[i]->sizeupvalues>0) f->p[i]->upvalues[0].instack=0;
+ }
+ return f;
+}
+
 static int writer(sol_State* L, const void* p, size_t size, void* u)
 {
  UNUSED(L);
  return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
 }
 
+#if defined(SOLC_USE_THREADS)
+/*
+** parallel compilation: each thread compiles files in its own state and
+** dumps them to memory; these dumps are then loaded in order
+*/
+
+typedef struct Chunk
+{
+ const char* filename;
+ char* b;				/* dump or error message */
+ size_t size;
+ int status;
+} Chunk;
+
+typedef struct Jobs
+{
+ Chunk* chunks;
+ int n;
+ int next;				/* next file to compile */
+ pthread_mutex_t lock;
+} Jobs;
+
+static int memwriter(sol_State* L, const void* p, size_t size, void* u)
+{
+ Chunk* c=(Chunk*)u;
+ char* b=(char*)realloc(c->b,c->size+size);
+ UNUSED(L);
+ if (b==NULL) return 1;
+ memcpy(b+c->size,p,size);
+ c->b=b;
+ c->size+=size;
+ return 0;
+}
+
+static void failed(Chunk* c, const char* message)
+{
+ free(c->b);
+ c->size=strlen(message);
+ c->b=(char*)malloc(c->size+1);
+ if (c->b!=NULL) memcpy(c->b,message,c->size+1);
+ c->status=SOL_ERRRUN;
+}
+
+static void* worker(void* ud)
+{
+ Jobs* J=(Jobs*)ud;
+ sol_State* L=solL_newstate();
+ for (;;)
+ {
+  Chunk* c;
+  pthread_mutex_lock(&J->lock);
+  c=(J->next<J->n) ? &J->chunks[J->next++] : NULL;
+  pthread_mutex_unlock(&J->lock);
+  if (c==NULL) break;
+  if (L==NULL)
+   failed(c,"cannot create state: not enough memory");
+  else if (solL_loadfile(L,c->filename)!=SOL_OK)
+   failed(c,sol_tostring(L,-1));
+  else if (sol_dump(L,memwriter,c,0)!=0)
+   failed(c,"not enough memory");
+  if (L!=NULL) sol_settop(L,0);
+ }
+ if (L!=NULL) sol_close(L);
+ return NULL;
+}
+
+static void compile(sol_State* L, int n, const char** filenames)
+{
+ Jobs J;
+ pthread_t* threads;
+ int i,nt=(jobs<n) ? jobs : n;
+ J.chunks=(Chunk*)calloc(n,sizeof(Chunk));
+ threads=(pthread_t*)malloc(nt*sizeof(pthread_t));
+ if (J.chunks==NULL || threads==NULL) fatal("not enough memory");
+ for (i=0; i<n; i++) J.chunks[i].filename=filenames[i];
+ J.n=n;
+ J.next=0;
+ pthread_mutex_init(&J.lock,NULL);
+ for (i=0; i<nt; i++)
+  if (pthread_create(&threads[i],NULL,worker,&J)!=0) fatal("cannot create thread");
+ for (i=0; i<nt; i++) pthread_join(threads[i],NULL);
+ pthread_mutex_destroy(&J.lock);
+ for (i=0; i<n; i++)			/* load the dumps in order */
+ {
+  Chunk* c=&J.chunks[i];
+  if (c->status!=SOL_OK)
+   fatal(c->b!=NULL ? c->b : "not enough memory");
+  if (solL_loadbufferx(L,c->b,c->size,"=?","b")!=SOL_OK) fatal(sol_tostring(L,-1));
+  free(c->b);
+ }
+ free(threads);
+ free(J.chunks);
+}
+#endif
+
 static int pmain(sol_State* L)
 {
  int argc=(int)sol_tointeger(L,1);
  char** argv=(char**)sol_touserdata(L,2);
+ const char** filenames;
  const Proto* f;
  int i;
  tmname=G(L)->tmname;
- if (!sol_checkstack(L,argc)) fatal("too many input files");
+ if (!sol_checkstack(L,argc+1)) fatal("too many input files");
+ filenames=(const char**)sol_newuserdatauv(L,argc*sizeof(char*),0);
  for (i=0; i<argc; i++)
  {
-  const char* filename=IS("-") ? NULL : argv[i];
-  if (solL_loadfile(L,filename)!=SOL_OK) fatal(sol_tostring(L,-1));
+  filenames[i]=argv[i];
+  if (bundling) modname(L,argv[i],&filenames[i]), sol_pop(L,1);
+  if (strcmp(filenames[i],"-")==0) filenames[i]=NULL;	/* stdin */
  }
- f=combine(L,argc);
+#if defined(SOLC_USE_THREADS)
+ if (jobs>1 && argc>1)
+  compile(L,argc,filenames);
+ else
+#endif
+ for (i=0; i<argc; i++)
+  if (solL_loadfile(L,filenames[i])!=SOL_OK) fatal(sol_tostring(L,-1));
+ f=bundling ? bundle(L,argc,argv) : combine(L,argc);
  if (listing) solU_print(f,listing>1);
  if (dumping)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
   if (D==NULL) cannot("open");
   sol_lock(L);
-  solU_dump(L,f,writer,D,stripping);
+  solU_dump(L,f,writer,D,stripping,aligning);
   sol_unlock(L);
   if (ferror(D)) cannot("write");
   if (fclose(D)) cannot("close");
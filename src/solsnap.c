@@ -0,0 +1,660 @@
+/*
+** $Id: solsnap.c $
+** Sol heap snapshot analyzer (summaries, retained sizes, diffs)
+** See Copyright Notice in sol.h
+*/
+
+#define solsnap_c
+#define SOL_CORE
+
+#include "lprefix.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sol.h"
+
+#include "lobject.h"
+#include "lsnap.h"
+
+/* snapshots may be larger than what a 'long' offset can reach */
+#if defined(SOL_USE_POSIX)
+#define l_fseek(f,o,w)	fseeko(f,(off_t)(o),w)
+#else
+#define l_fseek(f,o,w)	fseek(f,(long)(o),w)
+#endif
+
+#define PROGNAME	"solsnap"	/* default program name */
+#define LABELSIZE	128		/* longest label kept */
+
+static int top=20;			/* number of entries to show */
+static int retained=0;			/* compute retained sizes? */
+static int diffing=0;			/* compare two snapshots? */
+static const char* progname=PROGNAME;	/* actual program name */
+
+static void fatal(const char* message)
+{
+ fprintf(stderr,"%s: %s\n",progname,message);
+ exit(EXIT_FAILURE);
+}
+
+static void cannot(const char* what, const char* name)
+{
+ fprintf(stderr,"%s: cannot %s %s: %s\n",progname,what,name,strerror(errno));
+ exit(EXIT_FAILURE);
+}
+
+static void usage(const char* message)
+{
+ if (*message=='-')
+  fprintf(stderr,"%s: unrecognized option '%s'\n",progname,message);
+ else
+  fprintf(stderr,"%s: %s\n",progname,message);
+ fprintf(stderr,
+  "usage: %s [options] snapshot [newsnapshot]\n"
+  "Available options are:\n"
+  "  -d       show growth from 'snapshot' to 'newsnapshot'\n"
+  "  -n num   show 'num' entries in each list (default is 20)\n"
+  "  -r       compute retained sizes (loads the whole object graph, about\n"
+  "           64 bytes per object and 8 per reference, in memory)\n"
+  "  -v       show version information\n"
+  "  --       stop handling options\n"
+  ,progname);
+ exit(EXIT_FAILURE);
+}
+
+#define IS(s)	(strcmp(argv[i],s)==0)
+
+static int doargs(int argc, char* argv[])
+{
+ int i;
+ if (argv[0]!=NULL && *argv[0]!=0) progname=argv[0];
+ for (i=1; i<argc; i++)
+ {
+  if (*argv[i]!='-')			/* end of options; keep it */
+   break;
+  else if (IS("--"))			/* end of options; skip it */
+  {
+   ++i;
+   break;
+  }
+  else if (IS("-d"))			/* diff */
+   diffing=1;
+  else if (IS("-n"))			/* number of entries */
+  {
+   const char* n=argv[++i];
+   if (n==NULL || (top=atoi(n))<=0) usage("'-n' needs a positive number");
+  }
+  else if (IS("-r"))			/* retained sizes */
+   retained=1;
+  else if (IS("-v"))			/* show version */
+  {
+   printf("%s\n",SOL_COPYRIGHT);
+   if (argc==2) exit(EXIT_SUCCESS);
+  }
+  else					/* unknown option */
+   usage(argv[i]);
+ }
+ return i;
+}
+
+/*
+** {======================================================
+** Reading snapshots
+** =======================================================
+*/
+
+typedef struct Reader {
+ FILE* f;
+ const char* name;
+} Reader;
+
+typedef struct Record {
+ int tag;				/* SNAP_ROOTS or SNAP_OBJECT */
+ int tt;				/* variant tag of object */
+ size_t id, size;
+ size_t labellen;
+ char label[LABELSIZE];
+} Record;
+
+static void corrupted(const Reader* R)
+{
+ fprintf(stderr,"%s: %s: truncated or corrupted snapshot\n",progname,R->name);
+ exit(EXIT_FAILURE);
+}
+
+static int readbyte(Reader* R)
+{
+ int c=getc(R->f);
+ if (c==EOF) corrupted(R);
+ return c;
+}
+
+static size_t readsize(Reader* R)
+{
+ size_t x=0;
+ int b;
+ do
+ {
+  b=readbyte(R);
+  x=(x<<7) | (b & 0x7f);
+ } while ((b & 0x80)==0);
+ return x;
+}
+
+static void openreader(Reader* R, const char* name)
+{
+ char sig[sizeof(SOL_SNAPSIGNATURE)-1];
+ R->name=name;
+ R->f=fopen(name,"rb");
+ if (R->f==NULL) cannot("open",name);
+ if (fread(sig,sizeof(sig),1,R->f)!=1
+  || memcmp(sig,SOL_SNAPSIGNATURE,sizeof(sig))!=0)
+ {
+  fprintf(stderr,"%s: %s: not a heap snapshot\n",progname,name);
+  exit(EXIT_FAILURE);
+ }
+ if (readbyte(R)!=SNAP_FORMAT)
+ {
+  fprintf(stderr,"%s: %s: format mismatch\n",progname,name);
+  exit(EXIT_FAILURE);
+ }
+}
+
+static void rewindreader(Reader* R)
+{
+ if (l_fseek(R->f,sizeof(SOL_SNAPSIGNATURE),SEEK_SET)!=0)
+  cannot("seek",R->name);
+}
+
+/* read next record header; returns 0 at the end of the snapshot */
+static int readrecord(Reader* R, Record* r)
+{
+ r->tag=readbyte(R);
+ if (r->tag==SNAP_END) return 0;
+ if (r->tag==SNAP_OBJECT)
+ {
+  size_t i;
+  r->tt=readbyte(R);
+  r->id=readsize(R);
+  r->size=readsize(R);
+  r->labellen=readsize(R);
+  for (i=0; i<r->labellen; i++)
+  {
+   int c=readbyte(R);
+   if (i<LABELSIZE-1) r->label[i]=(char)c;
+  }
+  if (r->labellen>LABELSIZE-1) r->labellen=LABELSIZE-1;
+  r->label[r->labellen]=0;
+ }
+ else if (r->tag!=SNAP_ROOTS)
+  corrupted(R);
+ return 1;
+}
+
+/* read next edge of current record; returns 0 after the last one */
+static int readedge(Reader* R, int* kind, size_t* id)
+{
+ *kind=readbyte(R);
+ if (*kind==0) return 0;
+ *id=readsize(R);
+ return 1;
+}
+
+static void skipedges(Reader* R)
+{
+ int kind;
+ size_t id;
+ while (readedge(R,&kind,&id)) ;
+}
+
+static const char* tagname(int tt)
+{
+ switch (tt)
+ {
+  case SOL_VSHRSTR: case SOL_VLNGSTR: return "string";
+  case SOL_VTABLE: return "table";
+  case SOL_VLCL: return "function";
+  case SOL_VCCL: return "cfunction";
+  case SOL_VUSERDATA: return "userdata";
+  case SOL_VTHREAD: return "thread";
+  case SOL_VUPVAL: return "upvalue";
+  case SOL_VPROTO: return "proto";
+  default: return "?";
+ }
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Groups: objects aggregated by type and label
+** =======================================================
+*/
+
+typedef struct Group {
+ char* name;
+ long long count[2];			/* objects in each snapshot */
+ long long bytes[2];			/* bytes in each snapshot */
+ long long key;				/* sort key */
+} Group;
+
+static Group* groups=NULL;
+static size_t ngroups=0, sizegroups=0;
+static size_t* gindex=NULL;		/* hash of 'groups' (index + 1) */
+static size_t sizegindex=0;
+
+static void* xrealloc(void* p, size_t n)
+{
+ p=realloc(p,n);
+ if (p==NULL && n>0) fatal("not enough memory");
+ return p;
+}
+
+static unsigned int hashname(const char* s)
+{
+ unsigned int h=2166136261u;
+ while (*s) h=(h ^ (unsigned char)*s++)*16777619u;
+ return h;
+}
+
+static void rehashgroups(void)
+{
+ size_t i;
+ sizegindex=(sizegindex==0) ? 1024 : 2*sizegindex;
+ free(gindex);
+ gindex=(size_t*)xrealloc(NULL,sizegindex*sizeof(size_t));
+ memset(gindex,0,sizegindex*sizeof(size_t));
+ for (i=0; i<ngroups; i++)
+ {
+  size_t j=hashname(groups[i].name)&(sizegindex-1);
+  while (gindex[j]!=0) j=(j+1)&(sizegindex-1);
+  gindex[j]=i+1;
+ }
+}
+
+/* strings are grouped only by type; other objects also by label */
+static void groupname(const Record* r, char* buff, size_t size)
+{
+ const char* name=tagname(r->tt);
+ size_t n=strlen(name);
+ l_sprintf(buff,size,"%s",name);
+ if (r->labellen!=0 && novariant(r->tt)!=SOL_TSTRING && n+1<size)
+ {
+  buff[n]=' ';
+  l_sprintf(buff+n+1,size-n-1,"%s",r->label);
+ }
+}
+
+static Group* getgroup(const char* name)
+{
+ size_t j;
+ if (2*(ngroups+1)>sizegindex) rehashgroups();
+ for (j=hashname(name)&(sizegindex-1); gindex[j]!=0; j=(j+1)&(sizegindex-1))
+  if (strcmp(groups[gindex[j]-1].name,name)==0) return &groups[gindex[j]-1];
+ if (ngroups==sizegroups)
+ {
+  sizegroups=(sizegroups==0) ? 256 : 2*sizegroups;
+  groups=(Group*)xrealloc(groups,sizegroups*sizeof(Group));
+ }
+ gindex[j]=ngroups+1;
+ memset(&groups[ngroups],0,sizeof(Group));
+ groups[ngroups].name=(char*)xrealloc(NULL,strlen(name)+1);
+ strcpy(groups[ngroups].name,name);
+ return &groups[ngroups++];
+}
+
+/* add all objects of a snapshot to their groups (in slot 'which') */
+static void readgroups(const char* name, int which)
+{
+ Reader R;
+ Record r;
+ char buff[LABELSIZE+16];
+ openreader(&R,name);
+ while (readrecord(&R,&r))
+ {
+  if (r.tag==SNAP_OBJECT)
+  {
+   Group* g;
+   groupname(&r,buff,sizeof(buff));
+   g=getgroup(buff);
+   g->count[which]++;
+   g->bytes[which]+=(long long)r.size;
+  }
+  skipedges(&R);
+ }
+ fclose(R.f);
+}
+
+static int bykey(const void* a, const void* b)
+{
+ long long ka=((const Group*)a)->key, kb=((const Group*)b)->key;
+ return (ka<kb) - (ka>kb);		/* descending */
+}
+
+static void printgroups(void)
+{
+ size_t i;
+ long long count=0, bytes=0;
+ for (i=0; i<ngroups; i++)
+ {
+  groups[i].key=groups[i].bytes[0];
+  count+=groups[i].count[0];
+  bytes+=groups[i].bytes[0];
+ }
+ qsort(groups,ngroups,sizeof(Group),bykey);
+ printf("%lld objects, %lld bytes\n\n%12s %12s  %s\n",count,bytes,
+	"bytes","objects","group");
+ for (i=0; i<ngroups && i<(size_t)top; i++)
+  printf("%12lld %12lld  %s\n",groups[i].bytes[0],groups[i].count[0],
+	groups[i].name);
+}
+
+static void printdiff(void)
+{
+ size_t i;
+ long long dcount=0, dbytes=0;
+ for (i=0; i<ngroups; i++)
+ {
+  groups[i].key=groups[i].bytes[1]-groups[i].bytes[0];
+  dcount+=groups[i].count[1]-groups[i].count[0];
+  dbytes+=groups[i].key;
+ }
+ qsort(groups,ngroups,sizeof(Group),bykey);
+ printf("%+lld objects, %+lld bytes\n\n%12s %12s  %s\n",dcount,dbytes,
+	"bytes","objects","group");
+ for (i=0; i<ngroups && i<(size_t)top && groups[i].key>0; i++)
+  printf("%+12lld %+12lld  %s\n",groups[i].key,
+	groups[i].count[1]-groups[i].count[0],groups[i].name);
+}
+
+/* }====================================================== */
+
+/*
+** {======================================================
+** Retained sizes
+** =======================================================
+** The object graph is loaded with 32-bit indices; node 'nobjs' is a
+** virtual root pointing to the snapshot roots. Weak references do not
+** retain objects, so they are not part of the graph. Dominators are
+** computed with the iterative algorithm by Cooper, Harvey and Kennedy;
+** the retained size of an object is the size of its subtree in the
+** dominator tree.
+** The whole graph stays in memory, about 64 bytes per object and 8 per
+** reference at the peak, so '-r' needs memory in proportion to the heap
+** that was dumped; snapshots with 2^32-1 or more objects or references
+** are rejected.
+*/
+
+typedef unsigned int Index;
+
+#define NONE	((Index)-1)
+
+static size_t nobjs;
+static size_t* ids;			/* object ids, in file order */
+static size_t* sizes;
+static Index* idmap;			/* hash from ids to indices */
+static size_t sizeidmap;
+static Index* eoff;			/* edges of 'i' are eoff[i]..eoff[i+1]-1 */
+static Index* edges;
+static Index rootfirst, rootlast;	/* edges of the virtual root */
+
+static void edgerange(Index v, Index* first, Index* last)
+{
+ if (v==(Index)nobjs)
+ {
+  *first=rootfirst;
+  *last=rootlast;
+ }
+ else
+ {
+  *first=eoff[v];
+  *last=eoff[v+1];
+ }
+}
+
+static size_t hashid(size_t id)
+{
+ return (size_t)((id>>4)*2654435761u)&(sizeidmap-1);
+}
+
+static Index findid(size_t id)
+{
+ size_t j;
+ for (j=hashid(id); idmap[j]!=NONE; j=(j+1)&(sizeidmap-1))
+  if (ids[idmap[j]]==id) return idmap[j];
+ return NONE;
+}
+
+static void loadgraph(Reader* R)
+{
+ Record r;
+ size_t i, nedges=0, e;
+ int kind;
+ size_t id;
+ nobjs=0;
+ while (readrecord(R,&r))		/* first pass: count objects and edges */
+ {
+  if (r.tag==SNAP_OBJECT) nobjs++;
+  while (readedge(R,&kind,&id)) nedges++;
+ }
+ if (nobjs>=NONE-1 || nedges>=NONE) fatal("snapshot too large for '-r'");
+ ids=(size_t*)xrealloc(NULL,nobjs*sizeof(size_t));
+ sizes=(size_t*)xrealloc(NULL,(nobjs+1)*sizeof(size_t));
+ for (sizeidmap=1; sizeidmap<2*nobjs; sizeidmap*=2) ;
+ idmap=(Index*)xrealloc(NULL,sizeidmap*sizeof(Index));
+ memset(idmap,0xff,sizeidmap*sizeof(Index));
+ rewindreader(R);
+ for (i=0; readrecord(R,&r); )		/* second pass: objects */
+ {
+  if (r.tag==SNAP_OBJECT)
+  {
+   size_t j=0;
+   ids[i]=r.id;
+   sizes[i]=r.size;
+   for (j=hashid(r.id); idmap[j]!=NONE; j=(j+1)&(sizeidmap-1)) ;
+   idmap[j]=(Index)i++;
+  }
+  skipedges(R);
+ }
+ sizes[nobjs]=0;
+ eoff=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ edges=(Index*)xrealloc(NULL,(nedges+1)*sizeof(Index));
+ rewindreader(R);
+ for (i=0, e=0; readrecord(R,&r); )	/* third pass: edges */
+ {
+  if (r.tag==SNAP_OBJECT)
+   eoff[i++]=(Index)e;
+  else
+   rootfirst=(Index)e;
+  while (readedge(R,&kind,&id))
+  {
+   Index to=(kind==SNAP_EWEAK) ? NONE : findid(id);
+   if (to!=NONE) edges[e++]=to;
+  }
+  if (r.tag==SNAP_ROOTS) rootlast=(Index)e;
+ }
+ eoff[nobjs]=(Index)e;
+}
+
+static Index* post;			/* post-order number of each node */
+static Index* order;			/* nodes in post order */
+static Index* idom;
+
+/* iterative depth-first search from the root */
+static size_t postorder(void)
+{
+ Index root=(Index)nobjs;
+ size_t n=0, sp=0;
+ Index* stack=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ Index* next=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ size_t i;
+ for (i=0; i<=nobjs; i++) post[i]=NONE;
+ stack[sp++]=root;
+ next[root]=0;
+ post[root]=NONE-1;			/* visited, not finished */
+ while (sp>0)
+ {
+  Index v=stack[sp-1];
+  Index first, last;
+  edgerange(v,&first,&last);
+  if (first+next[v]<last)
+  {
+   Index w=edges[first+next[v]++];
+   if (post[w]==NONE)
+   {
+    post[w]=NONE-1;
+    next[w]=0;
+    stack[sp++]=w;
+   }
+  }
+  else
+  {
+   post[v]=(Index)n;
+   order[n++]=v;
+   sp--;
+  }
+ }
+ free(stack);
+ free(next);
+ return n;
+}
+
+static Index intersect(Index a, Index b)
+{
+ while (a!=b)
+ {
+  while (post[a]<post[b]) a=idom[a];
+  while (post[b]<post[a]) b=idom[b];
+ }
+ return a;
+}
+
+static int byretained(const void* a, const void* b)
+{
+ size_t sa=sizes[*(const Index*)a], sb=sizes[*(const Index*)b];
+ return (sa<sb) - (sa>sb);		/* descending */
+}
+
+static int byindex(const void* a, const void* b)
+{
+ Index ia=*(const Index*)a, ib=*(const Index*)b;
+ return (ia>ib) - (ia<ib);
+}
+
+static void computeretained(const char* name)
+{
+ Reader R;
+ Record r;
+ Record* found;
+ Index root;
+ Index *poff, *preds, *fill, *best, *sorted;
+ size_t n, i, j, k, nbest;
+ int changed;
+ openreader(&R,name);
+ loadgraph(&R);
+ root=(Index)nobjs;
+ post=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ order=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ n=postorder();
+ /* predecessors of reachable nodes */
+ poff=(Index*)xrealloc(NULL,(nobjs+2)*sizeof(Index));
+ memset(poff,0,(nobjs+2)*sizeof(Index));
+ for (i=0; i<n; i++)
+ {
+  Index e, last;
+  edgerange(order[i],&e,&last);
+  for (; e<last; e++) poff[edges[e]+1]++;
+ }
+ for (i=0; i<=nobjs; i++) poff[i+1]+=poff[i];
+ preds=(Index*)xrealloc(NULL,(poff[nobjs+1]+1)*sizeof(Index));
+ fill=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ memcpy(fill,poff,(nobjs+1)*sizeof(Index));
+ for (i=0; i<n; i++)
+ {
+  Index e, last;
+  edgerange(order[i],&e,&last);
+  for (; e<last; e++) preds[fill[edges[e]]++]=order[i];
+ }
+ free(fill);
+ idom=(Index*)xrealloc(NULL,(nobjs+1)*sizeof(Index));
+ for (i=0; i<=nobjs; i++) idom[i]=NONE;
+ idom[root]=root;
+ do					/* iterate in reverse post order */
+ {
+  changed=0;
+  for (i=n-1; i-->0; )
+  {
+   Index v=order[i];
+   Index nidom=NONE, p;
+   for (p=poff[v]; p<poff[v+1]; p++)
+   {
+    Index u=preds[p];
+    if (idom[u]==NONE) continue;
+    nidom=(nidom==NONE) ? u : intersect(u,nidom);
+   }
+   if (nidom!=idom[v])
+   {
+    idom[v]=nidom;
+    changed=1;
+   }
+  }
+ } while (changed);
+ for (i=0; i+1<n; i++)			/* accumulate in post order */
+ {
+  Index v=order[i];
+  if (idom[v]!=root) sizes[idom[v]]+=sizes[v];
+ }
+ best=(Index*)xrealloc(NULL,(n+1)*sizeof(Index));
+ for (i=0, nbest=0; i<n; i++) if (order[i]!=root) best[nbest++]=order[i];
+ qsort(best,nbest,sizeof(Index),byretained);
+ if (nbest>(size_t)top) nbest=top;
+ sorted=(Index*)xrealloc(NULL,(nbest+1)*sizeof(Index));
+ found=(Record*)xrealloc(NULL,(nbest+1)*sizeof(Record));
+ if (nbest>0) memcpy(sorted,best,nbest*sizeof(Index));
+ qsort(sorted,nbest,sizeof(Index),byindex);
+ rewindreader(&R);			/* find labels of all of them at once */
+ for (i=0, j=0; j<nbest && readrecord(&R,&r); )
+ {
+  skipedges(&R);
+  if (r.tag==SNAP_OBJECT && (Index)i++==sorted[j]) found[j++]=r;
+ }
+ printf("\n%12s  %s\n","retained","object");
+ for (k=0; k<nbest; k++)
+ {
+  const Index* p=(const Index*)bsearch(&best[k],sorted,nbest,sizeof(Index),
+	byindex);
+  const Record* f=&found[p-sorted];
+  printf("%12lu  %s %s\n",(unsigned long)sizes[best[k]],tagname(f->tt),
+	f->label);
+ }
+ fclose(R.f);
+ free(found); free(sorted);
+ free(best); free(idom); free(preds); free(poff); free(order); free(post);
+ free(edges); free(eoff); free(idmap); free(sizes); free(ids);
+}
+
+/* }====================================================== */
+
+int main(int argc, char* argv[])
+{
+ int i=doargs(argc,argv);
+ argc-=i; argv+=i;
+ if (argc!=(diffing ? 2 : 1))
+  usage(diffing ? "two snapshots needed" : "one snapshot needed");
+ readgroups(argv[0],0);
+ if (diffing)
+ {
+  readgroups(argv[1],1);
+  printdiff();
+ }
+ else
+  printgroups();
+ if (retained) computeretained(argv[diffing]);
+ while (ngroups>0) free(groups[--ngroups].name);
+ free(groups);
+ free(gindex);
+ return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+-- aligned chunks with absolute line info (functions with more than 128
+-- instructions, or many one-line functions) load in place from any offset
+local solc = arg[-1]:gsub("sol$", "solc")
+local function check (src, test)
+  local name, out = os.tmpname(), os.tmpname()
+  local f = assert(io.open(name, "w"))
+  f:write(src)
+  f:close()
+  assert(os.execute(solc .. " -a -o " .. out .. " " .. name))
+  test(assert(loadfile(out, "B")))
+  os.remove(name); os.remove(out)
+end
+
+for _, n in ipairs{10, 70, 100, 130, 257} do
+  local parts = {"local M = {}"}
+  for i = 1, n do parts[#parts + 1] = "M.f" .. i .. "=function() return " .. i .. " end" end
+  parts[#parts + 1] = "return M"
+  check(table.concat(parts, "\n"), function (f)
+    local M = f()
+    for i = 1, n do assert(M["f" .. i]() == i) end
+  end)
+end
+
+local body = {"local function big (x)"}
+for i = 1, 300 do body[#body + 1] = "x = x + " .. i end
+body[#body + 1] = "return x, debug.getinfo(1, 'l').currentline end"
+body[#body + 1] = "return big"
+check(table.concat(body, "\n"), function (f)
+  local x, line = f()(0)
+  assert(x == 300 * 301 // 2 and line == 302)
+end)
+print("OK")
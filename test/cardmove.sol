@@ -0,0 +1,20 @@
+-- an entry moved by a collision to a slot under another card must stay
+-- reachable in young collections (card tables of large old tables)
+collectgarbage("generational")
+local M = 8191                  -- hash modulus for 8192 nodes
+local function key (pos, n) return M * (1000 + n) + pos end
+local t = {}
+for p = 0, 5999 do t[key(p, 0)] = true end
+for p = 6017, M - 1 do t[key(p, 0)] = true end
+-- free slots now are 6000..6016 (6016 starts a card) and 8191
+collectgarbage(); collectgarbage()      -- 't' is old
+t[key(0, 1)] = {1}              -- collides; goes to slot 8191
+t[key(1, 1)] = {2}              -- collides; goes to slot 6016
+t[key(6016, 0)] = {3}           -- moves the previous entry to slot 6015
+collectgarbage("step", 0)
+for _ = 1, 10000 do local _ = {0} end
+collectgarbage("step", 0)
+assert(t[key(0, 1)][1] == 1)
+assert(t[key(1, 1)][1] == 2)
+assert(t[key(6016, 0)][1] == 3)
+print "OK"
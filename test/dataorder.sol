@@ -0,0 +1,29 @@
+-- data chunks build the same tables as the equivalent constructors
+local function same (a, b)
+  if type(a) ~= "table" or type(b) ~= "table" then
+    return a == b or (a ~= a and b ~= b)
+  end
+  for k, v in pairs(a) do if not same(v, b[k]) then return false end end
+  for k in pairs(b) do if a[k] == nil then return false end end
+  return true
+end
+local function check (src)
+  local d = assert(load(src, "=d", "d"))
+  local c = assert(load("return " .. src))()
+  assert(same(d, c), src)
+end
+check("{'b', [1]='a'}")
+check("{[1]='a', 'b'}")
+check("{x=1, x=nil, y=2}")
+check("{[1]=1, [2]=2, nil, nil}")
+check("{1, 2, [2]='k', 3}")
+check("{[1.0]='f', 'p'}")
+local parts = {}
+for i = 1, 5000 do
+  parts[#parts + 1] = tostring(i)
+  if i % 3 == 0 then parts[#parts + 1] = "[" .. (i - 40) .. "]='k" .. i .. "'" end
+  if i % 50 == 0 then parts[#parts + 1] = "[" .. (i + 1) .. "]='n" .. i .. "'" end
+  if i % 97 == 0 then parts[#parts + 1] = "x" .. i .. "={" .. i .. ", [1]=0}" end
+end
+check("{" .. table.concat(parts, ",") .. "}")
+print("OK")
@@ -0,0 +1,15 @@
+-- data chunks with more fields than one flush (SOLI_DATAFLUSH), mixing
+-- keyed and positional fields after the first flush
+local parts = {"{"}
+for i = 1, 1024 do parts[#parts + 1] = i .. "," end
+parts[#parts + 1] = "x = 1,"
+for i = 1025, 4000 do
+  parts[#parts + 1] = i .. ","
+  if i % 7 == 0 then parts[#parts + 1] = "k" .. i .. " = " .. i .. "," end
+end
+parts[#parts + 1] = "}"
+local src = table.concat(parts, "\n")
+local t = assert(load(src, "=mixed", "d"))
+assert(#t == 4000 and t.x == 1 and t.k3997 == 3997)
+for i = 1, 4000 do assert(t[i] == i) end
+print("OK")
@@ -0,0 +1,18 @@
+-- a coroutine that transfers control to itself gets its own values back
+local f = coroutine.wrap(function ()
+  return coroutine.transfer(coroutine.running(), 5)
+end)
+assert(f() == 5)
+
+local co = coroutine.create(function (...)
+  local a, b = coroutine.transfer(coroutine.running(), 1, 2)
+  assert(a == 1 and b == 2)
+  local c, d, e = coroutine.transfer(coroutine.running(), "x", nil, 3)
+  assert(c == "x" and d == nil and e == 3)
+  local me = coroutine.running()
+  assert(select("#", coroutine.transfer(me)) == 0)
+  return "done"
+end)
+local ok, res = coroutine.resume(co)
+assert(ok and res == "done")
+print("OK")